@@ -0,0 +1,376 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file implements the interpreter for GDB agent expressions.
+ *
+ * Values are 64 bits wide.  gdb's register numbers are r0..r31, SREG
+ * (32), SP (33) and PC (34).  Memory references without an address
+ * space offset refer to data space: gdb computes local variable
+ * addresses from the frame pointer (r28/r29) that way.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avarice.h"
+#include "jtag.h"
+#include "agentexpr.h"
+
+// Opcodes, see gdb/gdbsupport/ax.def
+enum {
+    AX_FLOAT		= 0x01,
+    AX_ADD		= 0x02,
+    AX_SUB		= 0x03,
+    AX_MUL		= 0x04,
+    AX_DIV_SIGNED	= 0x05,
+    AX_DIV_UNSIGNED	= 0x06,
+    AX_REM_SIGNED	= 0x07,
+    AX_REM_UNSIGNED	= 0x08,
+    AX_LSH		= 0x09,
+    AX_RSH_SIGNED	= 0x0a,
+    AX_RSH_UNSIGNED	= 0x0b,
+    AX_TRACE		= 0x0c,
+    AX_TRACE_QUICK	= 0x0d,
+    AX_LOG_NOT		= 0x0e,
+    AX_BIT_AND		= 0x0f,
+    AX_BIT_OR		= 0x10,
+    AX_BIT_XOR		= 0x11,
+    AX_BIT_NOT		= 0x12,
+    AX_EQUAL		= 0x13,
+    AX_LESS_SIGNED	= 0x14,
+    AX_LESS_UNSIGNED	= 0x15,
+    AX_EXT		= 0x16,
+    AX_REF8		= 0x17,
+    AX_REF16		= 0x18,
+    AX_REF32		= 0x19,
+    AX_REF64		= 0x1a,
+    AX_IF_GOTO		= 0x20,
+    AX_GOTO		= 0x21,
+    AX_CONST8		= 0x22,
+    AX_CONST16		= 0x23,
+    AX_CONST32		= 0x24,
+    AX_CONST64		= 0x25,
+    AX_REG		= 0x26,
+    AX_END		= 0x27,
+    AX_DUP		= 0x28,
+    AX_POP		= 0x29,
+    AX_ZERO_EXT		= 0x2a,
+    AX_SWAP		= 0x2b,
+    AX_TRACENZ		= 0x2f,
+    AX_TRACE16		= 0x30,
+    AX_PICK		= 0x32,
+    AX_ROT		= 0x33,
+};
+
+enum {
+    AX_STACK_SIZE	= 64,
+    AX_MAX_STEPS	= 100000,	// guard against endless loops
+    AX_MAX_REF		= 256,		// largest trace/tracenz area
+};
+
+/** Read 'numBytes' (at most 8) of target memory at 'addr', little
+    endian **/
+static unsigned long long axRead(unsigned long addr, unsigned int numBytes)
+{
+    uchar buf[8];
+    unsigned long long val = 0;
+
+    if ((addr & ADDR_SPACE_MASK) == 0)
+	addr |= DATA_SPACE_ADDR_OFFSET;
+    theJtagICE->memoryRead(addr, numBytes, buf);
+
+    while (numBytes > 0)
+	val = (val << 8) | buf[--numBytes];
+
+    return val;
+}
+
+static void axTrace(axCollectFunc collect, unsigned long addr,
+		    unsigned int numBytes)
+{
+    if (collect == 0 || numBytes == 0)
+	return;
+
+    if ((addr & ADDR_SPACE_MASK) == 0)
+	addr |= DATA_SPACE_ADDR_OFFSET;
+    collect(addr, numBytes);
+}
+
+/** Return gdb register 'regno' **/
+static bool axRegister(unsigned int regno, long long &val)
+{
+    uchar regs[REGFILE_SIZE];
+
+    if (!theJtagICE->readRegisterFile(regs))
+	return false;
+
+    if (regno < 32)
+	val = regs[regno];
+    else if (regno == 32)
+	val = regs[REGFILE_SREG];
+    else if (regno == 33)
+	val = regs[REGFILE_SP] | (regs[REGFILE_SP + 1] << 8);
+    else if (regno == 34)
+	val = (unsigned long)regs[REGFILE_PC] |
+	    ((unsigned long)regs[REGFILE_PC + 1] << 8) |
+	    ((unsigned long)regs[REGFILE_PC + 2] << 16) |
+	    ((unsigned long)regs[REGFILE_PC + 3] << 24);
+    else
+	return false;
+
+    return true;
+}
+
+bool axEvaluate(const unsigned char *code, unsigned int length,
+		long long &result, axCollectFunc collect)
+{
+    long long stack[AX_STACK_SIZE];
+    int sp = 0;			// number of items on the stack
+    unsigned int pc = 0;
+    int steps = 0;
+
+// Check for 'n' operand bytes, 'in' items on the stack, and room for
+// 'out' more
+#define NEED(n, in, out) \
+    if (pc + (n) > length || sp < (in) || sp - (in) + (out) > AX_STACK_SIZE) \
+	goto fail
+#define TOP stack[sp - 1]
+#define NEXT stack[sp - 2]
+
+    try
+    {
+	while (pc < length)
+	{
+	    if (++steps > AX_MAX_STEPS)
+		goto fail;
+
+	    unsigned char op = code[pc++];
+	    unsigned long long arg = 0;
+	    int n;
+
+	    switch (op)
+	    {
+	    case AX_ADD:
+		NEED(0, 2, 1); NEXT += TOP; sp--; break;
+	    case AX_SUB:
+		NEED(0, 2, 1); NEXT -= TOP; sp--; break;
+	    case AX_MUL:
+		NEED(0, 2, 1); NEXT *= TOP; sp--; break;
+	    case AX_DIV_SIGNED:
+		NEED(0, 2, 1);
+		if (TOP == 0)
+		    goto fail;
+		NEXT /= TOP; sp--;
+		break;
+	    case AX_DIV_UNSIGNED:
+		NEED(0, 2, 1);
+		if (TOP == 0)
+		    goto fail;
+		NEXT = (unsigned long long)NEXT / (unsigned long long)TOP;
+		sp--;
+		break;
+	    case AX_REM_SIGNED:
+		NEED(0, 2, 1);
+		if (TOP == 0)
+		    goto fail;
+		NEXT %= TOP; sp--;
+		break;
+	    case AX_REM_UNSIGNED:
+		NEED(0, 2, 1);
+		if (TOP == 0)
+		    goto fail;
+		NEXT = (unsigned long long)NEXT % (unsigned long long)TOP;
+		sp--;
+		break;
+	    case AX_LSH:
+		NEED(0, 2, 1);
+		NEXT = TOP >= 64? 0: (unsigned long long)NEXT << TOP;
+		sp--;
+		break;
+	    case AX_RSH_SIGNED:
+		NEED(0, 2, 1);
+		NEXT = NEXT >> (TOP >= 64? 63: TOP);
+		sp--;
+		break;
+	    case AX_RSH_UNSIGNED:
+		NEED(0, 2, 1);
+		NEXT = TOP >= 64? 0: (unsigned long long)NEXT >> TOP;
+		sp--;
+		break;
+	    case AX_LOG_NOT:
+		NEED(0, 1, 1); TOP = !TOP; break;
+	    case AX_BIT_AND:
+		NEED(0, 2, 1); NEXT &= TOP; sp--; break;
+	    case AX_BIT_OR:
+		NEED(0, 2, 1); NEXT |= TOP; sp--; break;
+	    case AX_BIT_XOR:
+		NEED(0, 2, 1); NEXT ^= TOP; sp--; break;
+	    case AX_BIT_NOT:
+		NEED(0, 1, 1); TOP = ~TOP; break;
+	    case AX_EQUAL:
+		NEED(0, 2, 1); NEXT = NEXT == TOP; sp--; break;
+	    case AX_LESS_SIGNED:
+		NEED(0, 2, 1); NEXT = NEXT < TOP; sp--; break;
+	    case AX_LESS_UNSIGNED:
+		NEED(0, 2, 1);
+		NEXT = (unsigned long long)NEXT < (unsigned long long)TOP;
+		sp--;
+		break;
+
+	    case AX_EXT:
+	    case AX_ZERO_EXT:
+		NEED(1, 1, 1);
+		n = code[pc++];
+		if (n > 0 && n < 64)
+		{
+		    unsigned long long mask = (1ULL << n) - 1;
+
+		    if (op == AX_ZERO_EXT || !(TOP & (1ULL << (n - 1))))
+			TOP &= mask;
+		    else
+			TOP |= ~mask;
+		}
+		break;
+
+	    case AX_REF8:
+	    case AX_REF16:
+	    case AX_REF32:
+	    case AX_REF64:
+		NEED(0, 1, 1);
+		TOP = axRead(TOP, 1 << (op - AX_REF8));
+		break;
+
+	    case AX_IF_GOTO:
+		NEED(2, 1, 0);
+		arg = (code[pc] << 8) | code[pc + 1];
+		pc += 2;
+		if (stack[--sp] != 0)
+		    pc = arg;
+		break;
+	    case AX_GOTO:
+		NEED(2, 0, 0);
+		pc = (code[pc] << 8) | code[pc + 1];
+		break;
+
+	    case AX_CONST8:
+	    case AX_CONST16:
+	    case AX_CONST32:
+	    case AX_CONST64:
+		n = 1 << (op - AX_CONST8);
+		NEED(n, 0, 1);
+		while (n-- > 0)
+		    arg = (arg << 8) | code[pc++];
+		stack[sp++] = arg;
+		break;
+
+	    case AX_REG:
+		NEED(2, 0, 1);
+		arg = (code[pc] << 8) | code[pc + 1];
+		pc += 2;
+		if (!axRegister(arg, stack[sp]))
+		    goto fail;
+		sp++;
+		break;
+
+	    case AX_END:
+		result = sp > 0? TOP: 0;
+		return true;
+
+	    case AX_DUP:
+		NEED(0, 1, 2); stack[sp] = TOP; sp++; break;
+	    case AX_POP:
+		NEED(0, 1, 0); sp--; break;
+	    case AX_SWAP:
+		NEED(0, 2, 2);
+		arg = TOP; TOP = NEXT; NEXT = arg;
+		break;
+	    case AX_PICK:
+		NEED(1, 0, 1);
+		n = code[pc++];
+		if (n >= sp)
+		    goto fail;
+		stack[sp] = stack[sp - 1 - n];
+		sp++;
+		break;
+	    case AX_ROT:
+		// a b c => c a b
+		NEED(0, 3, 3);
+		arg = TOP;
+		TOP = NEXT;
+		NEXT = stack[sp - 3];
+		stack[sp - 3] = arg;
+		break;
+
+	    case AX_TRACE:
+		// addr size => (nothing)
+		NEED(0, 2, 0);
+		if (TOP < 0 || TOP > AX_MAX_REF)
+		    goto fail;
+		axTrace(collect, NEXT, TOP);
+		sp -= 2;
+		break;
+	    case AX_TRACE_QUICK:
+		// addr => addr
+		NEED(1, 1, 1);
+		axTrace(collect, TOP, code[pc++]);
+		break;
+	    case AX_TRACE16:
+		NEED(2, 1, 1);
+		axTrace(collect, TOP, (code[pc] << 8) | code[pc + 1]);
+		pc += 2;
+		break;
+	    case AX_TRACENZ:
+	    {
+		// addr size => (nothing), collect up to and including
+		// the first NUL byte
+		NEED(0, 2, 0);
+		if (TOP < 0 || TOP > AX_MAX_REF)
+		    goto fail;
+
+		unsigned int size = TOP, len = 0;
+		while (len < size && axRead(NEXT + len, 1) != 0)
+		    len++;
+		if (len < size)
+		    len++;
+		axTrace(collect, NEXT, len);
+		sp -= 2;
+		break;
+	    }
+
+	    default:
+		debugOut("agent expression: unsupported opcode 0x%02x\n", op);
+		goto fail;
+	    }
+	}
+    }
+    catch (jtag_exception& e)
+    {
+	debugOut("agent expression: target access failed: %s\n", e.what());
+	return false;
+    }
+
+#undef NEED
+#undef TOP
+#undef NEXT
+
+    // ran off the end without an "end" opcode
+  fail:
+    debugOut("agent expression: evaluation failed at offset %u\n", pc);
+    return false;
+}
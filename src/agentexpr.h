@@ -0,0 +1,43 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file declares the interpreter for GDB agent expressions, the
+ * bytecode gdb uses for breakpoint conditions and tracepoint actions
+ * (see "Agent Expressions" in the gdb manual).
+ *
+ * $Id$
+ */
+
+#ifndef INCLUDE_AGENTEXPR_H
+#define INCLUDE_AGENTEXPR_H
+
+/** Called by the trace opcodes to collect 'numBytes' of target memory
+    at 'addr' **/
+typedef void (*axCollectFunc)(unsigned long addr, unsigned int numBytes);
+
+/** Evaluate the agent expression 'code' of 'length' bytes against the
+    (halted) target, and return the value left on top of the stack in
+    'result' (0 if the stack is empty).  The trace opcodes call
+    'collect', if given.
+
+    Returns false if the expression is malformed, uses an unsupported
+    opcode (floating point, trace state variables, printf), or the
+    target could not be accessed.
+**/
+bool axEvaluate(const unsigned char *code, unsigned int length,
+		long long &result, axCollectFunc collect = 0);
+
+#endif /* INCLUDE_AGENTEXPR_H */
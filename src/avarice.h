@@ -33,6 +33,10 @@ extern bool debugMode;
 /** true if interrupts should be stepped over when stepping */
 extern bool ignoreInterrupts;
 
+/** true iff --incremental option specified: only reprogram pages
+    whose contents differ from the target **/
+extern bool incrementalProgramming;
+
 /** printf 'fmt, ...' if debugMode **/
 void vdebugOut(const char *fmt, va_list args);
 void debugOut(const char *fmt, ...);
@@ -0,0 +1,104 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * Throughput of the slicing CRC against the byte at a time routine,
+ * on mkII frames of a few sizes.  Not run by "make check"; run
+ * ./crc16bench [MB] by hand.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "crc16.h"
+
+extern "C" const unsigned short crc_table[256];
+
+static __attribute__((noinline))
+unsigned short byteCrcsum(const unsigned char *message,
+			  unsigned long length, unsigned short crc)
+{
+    while (length-- > 0)
+	crc = (crc >> 8) ^ crc_table[(crc ^ *message++) & 0xff];
+
+    return crc;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static volatile unsigned int sink;
+
+/** Keep the compiler from hoisting the work out of the loops **/
+#define clobber() __asm__ __volatile__("" : : : "memory")
+
+int main(int argc, char **argv)
+{
+    double megabytes = argc > 1? atof(argv[1]): 256;
+    // a short command, a flash page write, and a large memory read
+    static const unsigned long sizes[] = { 16, 256 + 20, 4096 };
+    static unsigned char data[4096];
+
+    if (megabytes <= 0)
+    {
+	fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+	return 1;
+    }
+
+    srand(1);
+    for (unsigned int i = 0; i < sizeof data; i++)
+	data[i] = rand();
+
+    for (unsigned int s = 0; s < sizeof sizes / sizeof sizes[0]; s++)
+    {
+	// not a constant, so that neither side is specialized for it
+	volatile unsigned long size = sizes[s];
+	unsigned long n = size;
+	long rounds = (long)(megabytes * 1024 * 1024 / n);
+	double start, secs[2];
+
+	start = now();
+	for (long i = 0; i < rounds; i++)
+	{
+	    sink += byteCrcsum(data, n, 0xffff);
+	    clobber();
+	}
+	secs[0] = now() - start;
+
+	start = now();
+	for (long i = 0; i < rounds; i++)
+	{
+	    sink += crcsum(data, n, 0xffff);
+	    clobber();
+	}
+	secs[1] = now() - start;
+
+	printf("%5lu byte frames: byte at a time %8.1f MB/s, "
+	       "slicing-by-8 %8.1f MB/s\n", n,
+	       secs[0] > 0? megabytes / secs[0]: 0,
+	       secs[1] > 0? megabytes / secs[1]: 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * Conformance test of the slicing CRC in crc16.c ("make check"): it
+ * must agree with the byte at a time routine of AVR067 for every
+ * length, alignment and start value.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc16.h"
+
+extern "C" const unsigned short crc_table[256];
+
+enum {
+    MAXDATA = 1100,
+    CRC_INIT = 0xffff,
+};
+
+static int failures;
+
+/** The byte at a time routine crc16.c used before **/
+static unsigned short byteCrcsum(const unsigned char *message,
+				 unsigned long length, unsigned short crc)
+{
+    while (length-- > 0)
+	crc = (crc >> 8) ^ crc_table[(crc ^ *message++) & 0xff];
+
+    return crc;
+}
+
+static void check(const char *what, const unsigned char *data,
+		  unsigned long length, unsigned short crc)
+{
+    unsigned short expected = byteCrcsum(data, length, crc);
+    unsigned short got = crcsum(data, length, crc);
+
+    if (got != expected)
+    {
+	printf("FAIL %s (%lu bytes, start 0x%04x): 0x%04x, expected 0x%04x\n",
+	       what, length, crc, got, expected);
+	failures++;
+    }
+}
+
+int main(void)
+{
+    static unsigned char data[MAXDATA + 16];
+    static const unsigned short starts[] = { CRC_INIT, 0, 0x1234, 0x8408 };
+
+    // The table against the bitwise definition (reflected 0x1021)
+    for (int i = 0; i < 256; i++)
+    {
+	unsigned short c = i;
+
+	for (int bit = 0; bit < 8; bit++)
+	    c = c & 1? (c >> 1) ^ 0x8408: c >> 1;
+	if (c != crc_table[i])
+	{
+	    printf("FAIL crc_table[%d] is 0x%04x, expected 0x%04x\n",
+		   i, crc_table[i], c);
+	    failures++;
+	}
+    }
+
+    // CRC-16/MCRF4XX check value
+    if (crcsum((const unsigned char *)"123456789", 9, CRC_INIT) != 0x6f91)
+    {
+	printf("FAIL check value of \"123456789\"\n");
+	failures++;
+    }
+
+    srand(1);
+    for (int i = 0; i < MAXDATA + 16; i++)
+	data[i] = rand();
+
+    for (unsigned int s = 0; s < sizeof starts / sizeof starts[0]; s++)
+	for (int offset = 0; offset < 8; offset++)
+	    for (unsigned long length = 0; length <= MAXDATA; length++)
+		check("random data", data + offset, length, starts[s]);
+
+    static unsigned char pattern[MAXDATA];
+    memset(pattern, 0xff, sizeof pattern);
+    for (unsigned long length = 0; length <= MAXDATA; length += 7)
+	check("erased flash", pattern, length, CRC_INIT);
+    memset(pattern, 0, sizeof pattern);
+    for (unsigned long length = 0; length <= MAXDATA; length += 7)
+	check("zeroes", pattern, length, CRC_INIT);
+
+    // crcappend and crcverify round trip, and a corrupted frame
+    static unsigned char frame[MAXDATA + 2];
+    for (unsigned long length = 1; length <= 300; length++)
+    {
+	memcpy(frame, data, length);
+	crcappend(frame, length);
+	if (!crcverify(frame, length + 2))
+	{
+	    printf("FAIL crcverify of %lu bytes\n", length);
+	    failures++;
+	}
+	frame[length / 2] ^= 0x10;
+	if (crcverify(frame, length + 2))
+	{
+	    printf("FAIL crcverify of a corrupted frame of %lu bytes\n",
+		   length);
+	    failures++;
+	}
+    }
+
+    if (failures)
+	printf("%d failures\n", failures);
+
+    return failures != 0;
+}
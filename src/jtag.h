@@ -272,6 +272,18 @@ enum
     MAX_JTAG_COMM_ATTEMPS	      = 10,
     MAX_JTAG_SYNC_ATTEMPS	      = 3,
 
+    // mkII commands sent before waiting for the first response
+    MAX_PIPELINED_COMMANDS	      = 4,
+    // consecutive flash pages handed to jtagWritePages() at once
+    MAX_PAGES_PER_WRITE		      = 16,
+    // asynchronous ICE events kept while waiting for responses
+    MAX_QUEUED_EVENTS		      = 16,
+    // data read from the ICE at once
+    RX_BUFFER_SIZE		      = 2048,
+    // recycled ICE frame buffers, see allocFrame()
+    FRAME_POOL_SIZE		      = 8,
+    FRAME_POOL_BUFSIZE		      = 1024,
+
     JTAG_RESPONSE_TIMEOUT	      = 1000000,
     JTAG_COMM_TIMEOUT		      = 100000,
     JTAG3_PIPE_TIMEOUT                = 100,
@@ -601,6 +613,30 @@ enum {
     PC_INVALID			      = 0xffffffff
 };
 
+// Layout of the register file as exchanged with gdb (see
+// gdb/avr-tdep.c): r0 .. r31, SREG, SPL, SPH, PC (4 bytes, little
+// endian).
+enum {
+    REGFILE_SREG		= 32,
+    REGFILE_SP			= 33,
+    REGFILE_PC			= 35,
+    REGFILE_SIZE		= 39
+};
+
+// Target memory cache geometry, see jtagcache.cc.  The valid and
+// dirty masks of a line hold one bit per byte.
+enum {
+    MEMCACHE_LINESIZE		= 32,
+    MEMCACHE_LINES		= 64
+};
+
+typedef struct {
+    unsigned long addr;		// line address, including address space
+    unsigned long valid;	// bytes that hold target memory contents
+    unsigned long dirty;	// bytes not yet written to the target
+    uchar data[MEMCACHE_LINESIZE];
+} memcache_line;
+
 /*
  * JTAG ICE mkII breakpoints are quite tricky.
  *
@@ -755,6 +791,8 @@ enum debugproto {
     PROTO_JTAG, PROTO_DW, PROTO_PDI,
 };
 
+struct usb_link;
+
 class jtag
 {
   protected:
@@ -765,9 +803,18 @@ class jtag
   // The file descriptor used while talking to the JTAG ICE
   int jtagBox;
 
+  // Data read from jtagBox, but not consumed yet (see timeout_read()).
+  // Valid data is between rxStart and rxEnd.
+  uchar rxBuffer[RX_BUFFER_SIZE];
+  unsigned int rxStart, rxEnd;
+
   // For the mkII device, is the box attached via USB?
   bool is_usb;
 
+  // State of the USB connection (jtag2usb.cc), NULL if not attached
+  // via USB
+  struct usb_link *usbLink;
+
   // The type of our emulator: JTAG ICE, or AVR Dragon.
   emulator emu_type;
 
@@ -787,6 +834,27 @@ class jtag
   // Target device is an ATxmega one
   bool is_xmega;
 
+  // Register file cache, valid while the target has not run since it
+  // was filled
+  uchar regFile[REGFILE_SIZE];
+  bool regFileValid;
+
+  // Target memory cache, valid while the target does not execute code
+  memcache_line memCache[MEMCACHE_LINES];
+
+  // Flash contents just programmed by gdb, valid like the memory cache
+  uchar *flashShadow;
+  unsigned int flashShadowSize;
+
+  // Asynchronous event frames that arrived while a command response
+  // was awaited, oldest first, as returned by the backend's recvFrame()
+  uchar *eventQueue[MAX_QUEUED_EVENTS];
+  int eventQueueHead, eventQueueCount;
+
+  // Free frame buffers, each at least FRAME_POOL_BUFSIZE bytes large
+  uchar *framePool[FRAME_POOL_SIZE];
+  int framePoolCount;
+
   public:
   // Whether we are in "programming mode" (changes how program memory
   // is written, apparently)
@@ -810,6 +878,27 @@ class jtag
   void openUSB(const char *jtagDeviceName);
   void resetUSB(void);
   int safewrite(const void *b, int count);
+
+  /** Read whatever the ICE has sent into the receive buffer, waiting
+      at most 'timeout' microseconds for data to arrive.  Returns the
+      number of bytes added, 0 on timeout. **/
+  int fillReceiveBuffer(unsigned long timeout);
+
+  /** Wait until at least 'count' (<= RX_BUFFER_SIZE) bytes are in
+      the receive buffer, in one piece starting at rxBuffer + rxStart.
+      Returns false on timeout. **/
+  bool receiveBytes(unsigned int count, unsigned long timeout);
+
+  /** Whether received data is waiting in the buffer, so select() on
+      jtagBox would not see it **/
+  bool receivePending(void) { return rxStart < rxEnd; }
+
+  /** Throw away all pending input from the ICE. **/
+  int flushInput(void)
+  {
+    rxStart = rxEnd = 0;
+    return tcflush(jtagBox, TCIFLUSH);
+  }
   void changeLocalBitRate(int newBitRate);
   void restoreSerialPort(void);
 
@@ -829,6 +918,50 @@ class jtag
 
   unsigned int get_page_size(BFDmemoryType memtype);
 
+  /** Append event frame 'evt' to the event queue, which takes over
+      ownership.  If the queue is full, the oldest event is dropped. **/
+  void queueEvent(uchar *evt);
+
+  /** Remove the oldest event from the queue and return it, or NULL if
+      the queue is empty.  Caller must freeFrame() it. **/
+  uchar *dequeueEvent(void);
+
+  /** Drop the queued events for which stale() returns true, or all of
+      them if 'stale' is NULL **/
+  void discardEvents(bool (*stale)(const uchar *evt) = NULL);
+
+  /** Return a buffer for an ICE frame of 'size' bytes.  Buffers up to
+      FRAME_POOL_BUFSIZE come from the frame pool, so the command and
+      response path does not need the heap.  Hand the buffer back with
+      freeFrame(), never delete [], which would lose it to the pool. **/
+  uchar *allocFrame(unsigned int size);
+
+  /** Return 'frame', obtained from allocFrame(), to the frame pool **/
+  void freeFrame(uchar *frame);
+
+  public:
+  /** Results of updatePage() **/
+  enum pageUpdate
+  {
+      PAGE_UNCHANGED,
+      PAGE_WRITTEN,
+      PAGE_NEEDS_CHIP_ERASE,
+  };
+
+  /** Reprogram the page at 'addr' if its contents differ from 'page' **/
+  pageUpdate updatePage(unsigned long addr, unsigned int size, uchar *page,
+			const bool *used = NULL);
+
+  protected:
+
+  // Target memory cache internals, see jtagcache.cc
+  int memCachePolicy(unsigned long lineAddr);
+  void memCacheFill(unsigned long lineAddr, unsigned int numLines);
+  void memCacheFillBytes(unsigned long lineAddr, unsigned long mask);
+  void memCacheWriteBack(memcache_line *line);
+  void uncachedRead(unsigned long addr, unsigned int numBytes, uchar *buf);
+  void uncachedWrite(unsigned long addr, unsigned int numBytes, uchar *buf);
+
   public:
   jtag(void);
   jtag(const char *dev, char *name, emulator type = EMULATOR_JTAGICE);
@@ -854,7 +987,7 @@ class jtag
   virtual void initJtagOnChipDebugging(unsigned long bitrate) = 0;
 
 
-  /** A timed-out read from file descriptor 'fd'.
+  /** A timed-out read from the ICE, through the receive buffer.
 
   'timeout' is in microseconds, it is the maximum interval within which
   the read must make progress (i.e., it's a per-byte timeout)
@@ -902,6 +1035,10 @@ class jtag
 
   virtual void eraseProgramPage(unsigned long address) = 0;
 
+  /** Whether eraseProgramPage() works on this device.  If not, flash
+      pages can only be erased along with the whole chip. **/
+  virtual bool pageEraseSupported(void) { return false; }
+
   /** Download an image contained in the specified file. */
   virtual void downloadToTarget(const char* filename, bool program, bool verify) = 0;
 
@@ -948,6 +1085,15 @@ class jtag
   **/
   virtual uchar *jtagRead(unsigned long addr, unsigned int numBytes) = 0;
 
+  /** Read 'numBytes' from target memory address 'addr' into 'buf',
+      which must hold that many bytes.  Throws a jtag_exception if the
+      read failed.
+
+      The default implementation copies the result of the above.
+  **/
+  virtual void jtagRead(unsigned long addr, unsigned int numBytes,
+			uchar *buf);
+
   /** Write 'numBytes' bytes from 'buffer' to target memory address 'addr'
 
     The memory space is selected by the high order bits of 'addr' (see
@@ -960,6 +1106,78 @@ class jtag
   **/
   virtual void jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[]) = 0;
 
+  /** Write 'numPages' consecutive flash or EEPROM pages of 'pageSize'
+    bytes each from 'buffer' to 'addr'.  This one writes them one by
+    one, the mkII keeps several page writes in flight.
+  **/
+  virtual void jtagWritePages(unsigned long addr, unsigned int pageSize,
+			      unsigned int numPages, uchar buffer[]);
+
+  /** Return the largest number of bytes that can be transferred by a
+    single jtagRead() or jtagWrite() to data memory.  All ICEs
+    supported so far handle 256 bytes per memory command.
+  **/
+  virtual unsigned int maxMemoryTransfer(void) const { return 256; }
+
+  // Register file cache
+  // -------------------
+
+  /** Copy the register file (layout see REGFILE_*) into 'regs'.
+
+    The registers are read from the target once after each stop, and
+    served from a cache until the target is resumed, stepped or reset.
+    Returns false if the registers could not be read.
+  **/
+  bool readRegisterFile(uchar *regs);
+
+  /** Write 'numBytes' from 'regs' to the register file at offset
+    'regOffset' (one of the REGFILE_* registers, or a range of r0..r31),
+    and update the cache accordingly.
+  **/
+  void writeRegisterFile(unsigned int regOffset, unsigned int numBytes,
+			 uchar *regs);
+
+  /** Forget the cached register file. **/
+  void invalidateRegisterFile(void) { regFileValid = false; }
+
+  /** Invalidate the register file cache if a memory write of
+    'numBytes' at 'addr' hits the CPU registers or the status area.
+  **/
+  void registerFileWrite(unsigned long addr, unsigned int numBytes);
+
+  // Cached memory access
+  // --------------------
+
+  /** Read 'numBytes' from target memory address 'addr' into 'buf'.
+
+    SRAM, I/O registers without read side effects and EEPROM are
+    served from a line cache while the target is halted; adjacent
+    missing lines are fetched with a single jtagRead().  Everything
+    else is passed on to jtagRead(), split into transfers the ICE can
+    handle.  Throws a jtag_exception on failure.
+  **/
+  void memoryRead(unsigned long addr, unsigned int numBytes, uchar *buf);
+
+  /** Write 'numBytes' from 'buf' to target memory address 'addr'.
+
+    SRAM writes are kept in the cache until the target executes code
+    again, everything else is written through to the target.
+  **/
+  void memoryWrite(unsigned long addr, unsigned int numBytes, uchar *buf);
+
+  /** Write back buffered SRAM writes, and forget the cached register
+    file and target memory.  To be called before the target executes
+    code.
+  **/
+  void invalidateCaches(void);
+
+  /** Serve flash reads below 'size' from 'image' (allocated with
+    new[], owned by the cache from now on), which has just been
+    programmed.  The image is dropped when the target executes code,
+    or flash is written through memoryWrite().
+  **/
+  void setFlashShadow(uchar *image, unsigned int size);
+
 
   /** Write fuses to target.
 
@@ -79,6 +79,7 @@ class jtag2: public jtag
     virtual void disableProgramming(void);
     virtual void eraseProgramMemory(void);
     virtual void eraseProgramPage(unsigned long address);
+    virtual bool pageEraseSupported(void);
     virtual void downloadToTarget(const char* filename, bool program, bool verify);
 
     virtual unsigned long getProgramCounter(void);
@@ -90,7 +91,11 @@ class jtag2: public jtag
     virtual bool jtagContinue(void);
 
     virtual uchar *jtagRead(unsigned long addr, unsigned int numBytes);
+    virtual void jtagRead(unsigned long addr, unsigned int numBytes,
+			  uchar *buf);
     virtual void jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[]);
+    virtual void jtagWritePages(unsigned long addr, unsigned int pageSize,
+				unsigned int numPages, uchar buffer[]);
     virtual unsigned int statusAreaAddress(void) const {
         return (is_xmega? 0x3D: 0x5D) + DATA_SPACE_ADDR_OFFSET;
     };
@@ -152,7 +157,7 @@ class jtag2: public jtag
 
 	If a negative response arrived, throw an exception.
 
-	Caller must delete [] the response.
+	Caller must release the response with freeFrame().
     **/
     void doJtagCommand(uchar *command, int  commandSize,
 		       uchar *&response, int &responseSize,
@@ -165,14 +170,33 @@ class jtag2: public jtag
     **/
     void doSimpleJtagCommand(uchar cmd);
 
+    /** A command for doJtagCommands(), and its response (to be
+	released with freeFrame() by the caller).
+    **/
+    struct pipelinedCommand {
+	uchar *command;
+	int commandSize;
+	uchar *response;
+	int responseSize;
+    };
+
+    /** Send the 'count' commands in 'cmds', with up to
+	MAX_PIPELINED_COMMANDS of them in flight, and match the
+	responses by sequence number.  Commands that fail or time out
+	are retried one by one through doJtagCommand() afterwards, which
+	throws if that does not help either.  Up to the retries, the
+	commands are executed in order.
+    **/
+    void doJtagCommands(pipelinedCommand *cmds, int count);
+
     // Miscellaneous
     // -------------
 
     /** Set JTAG ICE parameter 'item' to 'newValue' **/
     void setJtagParameter(uchar item, uchar *newValue, int valSize);
 
-    /** Return value of JTAG ICE parameter 'item'; caller must delete
-        [] resp
+    /** Return value of JTAG ICE parameter 'item'; caller must
+        freeFrame() resp
     **/
     void getJtagParameter(uchar item, uchar *&resp, int &respSize);
 
@@ -188,10 +212,15 @@ class jtag2: public jtag
      **/
     bool eventLoop(void);
 
-    /** Expect an ICE event in the input stream.
+    /** Expect an ICE event, from the event queue if one arrived
+	earlier, otherwise from the input stream.
      **/
     void expectEvent(bool &breakpoint, bool &gdbInterrupt);
 
+    /** Act upon event frame 'evtbuf' (as returned by recvFrame()).
+     **/
+    void processEvent(uchar *evtbuf, bool &breakpoint, bool &gdbInterrupt);
+
     /** Update Xmega breakpoints on target
      **/
     void xmegaSendBPs(void);
@@ -197,7 +197,7 @@ void jtag2::updateBreakpoints(void)
                         throw;
                     }
 
-		    delete [] response;
+		    freeFrame(response);
 		}
 
 		// rip breakpoint
@@ -287,7 +287,7 @@ void jtag2::updateBreakpoints(void)
                                 e.what());
                         throw;
                     }
-		    delete [] response;
+		    freeFrame(response);
 
 		    bp[bp_i].icestatus = true;
 		}
@@ -323,7 +323,7 @@ void jtag2::xmegaSendBPs(void)
                 e.what());
         throw;
     }
-    delete [] response;
+    freeFrame(response);
 
     xmega_n_bps = 0; // must be set again upon next run
 }
@@ -111,7 +111,7 @@ jtag2::~jtag2(void)
  */
 void jtag2::sendFrame(uchar *command, int commandSize)
 {
-    unsigned char *buf = new unsigned char[commandSize + 10];
+    unsigned char *buf = allocFrame(commandSize + 10);
 
     buf[0] = MESSAGE_START;
     u16_to_b2(buf + 1, command_sequence);
@@ -123,7 +123,7 @@ void jtag2::sendFrame(uchar *command, int commandSize)
 
     int count = safewrite(buf, commandSize + 10);
 
-    delete [] buf;
+    freeFrame(buf);
 
     if (count < 0)
         throw jtag_exception();
@@ -138,135 +138,73 @@ void jtag2::sendFrame(uchar *command, int commandSize)
  * whether it matches the expected sequence number, including event
  * notification frames (seqno == 0xffff).
  *
- * Caller must eventually free the buffer.
+ * Caller must eventually release the buffer with freeFrame().
  */
 int jtag2::recvFrame(unsigned char *&msg, unsigned short &seqno)
 {
-    enum states {
-	sSTART, sSEQNUM1, sSEQNUM2, sSIZE1, sSIZE2, sSIZE3, sSIZE4,
-	sTOKEN, sDATA, sCSUM1, sCSUM2, sDONE
-    }  state = sSTART;
-    unsigned int msglen = 0, l = 0;
-    unsigned int headeridx = 0;
-    bool ignorpkt = false;
-    int rv;
-    unsigned char c, *buf = NULL, header[8];
-    unsigned short r_seqno = 0;
-    unsigned short checksum = 0;
+    unsigned int msglen;
+    uchar *header, *buf;
 
     msg = NULL;
 
-    while (state != sDONE) {
-	if (state == sDATA) {
-	    debugOut("sDATA: reading %d bytes\n", msglen);
-	    rv = 0;
-	    if (ignorpkt) {
-		/* skip packet's contents */
-		for(l = 0; l < msglen; l++) {
-		    rv += timeout_read(&c, 1, JTAG_RESPONSE_TIMEOUT);
-		    debugOut("ign: 0x%02x\n", c);
-		}
-	    } else {
-		rv += timeout_read(buf + 8, msglen, JTAG_RESPONSE_TIMEOUT);
-		debugOut("read: ");
-		for (l = 0; l < msglen; l++) {
-		    debugOut(" %02x", buf[l + 8]);
-		}
-		debugOut("\n");
-	    }
-	    if (rv == 0)
-		/* timeout */
-		break;
-	} else {
-	    rv = timeout_read(&c, 1, JTAG_RESPONSE_TIMEOUT);
-	    if (rv == 0) {
-		/* timeout */
-		debugOut("recv: timeout\n");
-		break;
-	    }
-	    debugOut("recv: 0x%02x\n", c);
+    for (;;) {
+	if (!receiveBytes(8, JTAG_RESPONSE_TIMEOUT)) {
+	    debugOut("recv: timeout\n");
+	    rxStart = rxEnd;
+	    return 0;
+	}
+	header = rxBuffer + rxStart;
+
+	// Resynchronise on the next MESSAGE_START
+	if (header[0] != MESSAGE_START) {
+	    uchar *start = (uchar *)memchr(header + 1, MESSAGE_START,
+					   rxEnd - rxStart - 1);
+	    debugOut("recv: skipping garbage\n");
+	    rxStart = start == NULL? rxEnd: start - rxBuffer;
+	    continue;
+	}
+	if (header[7] != TOKEN) {
+	    rxStart++;
+	    continue;
 	}
-	checksum ^= c;
-
-	if (state < sDATA)
-	    header[headeridx++] = c;
 
-	switch (state) {
-	case sSTART:
-	    if (c == MESSAGE_START) {
-		state = sSEQNUM1;
-	    } else {
-		headeridx = 0;
-	    }
-	    break;
-	case sSEQNUM1:
-	    r_seqno = c;
-	    state = sSEQNUM2;
-	    break;
-	case sSEQNUM2:
-	    r_seqno |= ((unsigned)c << 8);
-	    state = sSIZE1;
-	    break;
-	case sSIZE1:
-	    state = sSIZE2;
-	    goto domsglen;
-	case sSIZE2:
-	    state = sSIZE3;
-	    goto domsglen;
-	case sSIZE3:
-	    state = sSIZE4;
-	    goto domsglen;
-	case sSIZE4:
-	    state = sTOKEN;
-	  domsglen:
-	    msglen >>= 8;
-	    msglen |= ((unsigned)c << 24);
-	    break;
-	case sTOKEN:
-	    if (c == TOKEN) {
-		state = sDATA;
-		if (msglen > MAX_MESSAGE) {
-		    printf("msglen %u exceeds max message size %u, ignoring message\n",
-			   msglen, MAX_MESSAGE);
-		    state = sSTART;
-		    headeridx = 0;
-		} else {
-		    buf = new unsigned char[msglen + 10];
-		    memcpy(buf, header, 8);
-		}
-	    } else {
-		state = sSTART;
-		headeridx = 0;
-	    }
-	    break;
-	case sDATA:
-	    /* The entire payload has been read above. */
-	    l = msglen + 8;
-	    state = sCSUM1;
-	    break;
-	case sCSUM1:
-	    buf[l++] = c;
-	    state = sCSUM2;
-	    break;
-	case sCSUM2:
-	    buf[l++] = c;
-	    if (crcverify(buf, msglen + 10)) {
-		debugOut("CRC OK");
-		state = sDONE;
-	    } else {
-		debugOut("checksum error");
-		delete [] buf;
-		return -1;
-	    }
-	    break;
-	default:
-	    debugOut("unknown state");
-	    delete [] buf;
-	    return -1;
+	msglen = header[3] | (header[4] << 8) | (header[5] << 16) |
+	    ((unsigned)header[6] << 24);
+	if (msglen > MAX_MESSAGE) {
+	    printf("msglen %u exceeds max message size %u, ignoring message\n",
+		   msglen, MAX_MESSAGE);
+	    rxStart += 8;
+	    continue;
 	}
+	break;
+    }
+
+    // Payload and CRC are read through the buffer, however large
+    buf = allocFrame(msglen + 10);
+    memcpy(buf, header, 8);
+    rxStart += 8;
+    if (timeout_read(buf + 8, msglen + 2, JTAG_RESPONSE_TIMEOUT) !=
+	(int)msglen + 2) {
+	debugOut("recv: timeout\n");
+	freeFrame(buf);
+	return 0;
+    }
+
+    if (debugMode) {
+	debugOut("read: ");
+	for (unsigned int l = 0; l < msglen; l++)
+	    debugOut(" %02x", buf[l + 8]);
+	debugOut("\n");
+    }
+
+    if (!crcverify(buf, msglen + 10)) {
+	debugOut("checksum error");
+	freeFrame(buf);
+	return -1;
     }
+    debugOut("CRC OK");
 
-    seqno = r_seqno;
+    seqno = buf[1] | (buf[2] << 8);
     msg = buf;
 
     return (int)msglen;
@@ -274,7 +212,7 @@ int jtag2::recvFrame(unsigned char *&msg, unsigned short &seqno)
 
 /*
  * Try receiving frames, until we get the reply we are expecting.
- * Caller must delete[] the msg after processing it.
+ * Caller must freeFrame() the msg after processing it.
  */
 int jtag2::recv(uchar *&msg)
 {
@@ -292,7 +230,7 @@ int jtag2::recv(uchar *&msg)
 	    /*
 	     * We move the payload to the beginning of the buffer, to make
 	     * the job easier for the caller.  We have to return the
-	     * original pointer though, as the caller must free() it.
+	     * original pointer though, as the caller must freeFrame() it.
 	     */
 	    memmove(msg, msg + 8, rv);
 	    return rv;
@@ -300,16 +238,14 @@ int jtag2::recv(uchar *&msg)
 	if (r_seqno == 0xffff) {
 	    debugOut("\ngot asynchronous event: 0x%02x\n",
 		     msg[8]);
-	    // XXX should we queue that event up somewhere?
-	    // How to process it?  Register event handlers
-	    // for interesting events?
-	    // For now, the only place that cares is jtagContinue
-	    // and it just calls recvFrame and handles events directly. 
+	    // expectEvent() picks it up from there
+	    queueEvent(msg);
+	    continue;
 	} else {
 	    debugOut("\ngot wrong sequence number, %u != %u\n",
 		     r_seqno, command_sequence);
 	}
-	delete [] msg;
+	freeFrame(msg);
     }
 }
 
@@ -322,7 +258,7 @@ int jtag2::recv(uchar *&msg)
     positive returns true, otherwise returns false.
 
     If response is positive, message (including response code) is
-    returned in &msg, caller must delete [] it.  The message size is
+    returned in &msg, caller must freeFrame() it.  The message size is
     returned in &msgsize.
 **/
 
@@ -332,12 +268,13 @@ bool jtag2::sendJtagCommand(uchar *command, int commandSize, int &tries,
     if (tries++ >= MAX_JTAG_COMM_ATTEMPS)
         throw jtag_exception("JTAG communication failed");
 
-    debugOut("\ncommand[0x%02x, %d]: ", command[0], tries);
-
-    for (int i = 0; i < commandSize; i++)
-	debugOut("%.2X ", command[i]);
-
-    debugOut("\n");
+    if (debugMode)
+    {
+	debugOut("\ncommand[0x%02x, %d]: ", command[0], tries);
+	for (int i = 0; i < commandSize; i++)
+	    debugOut("%.2X ", command[i]);
+	debugOut("\n");
+    }
 
     sendFrame(command, commandSize);
 
@@ -347,12 +284,13 @@ bool jtag2::sendJtagCommand(uchar *command, int commandSize, int &tries,
     else if (msgsize < 1)
 	return false;
 
-    debugOut("response: ");
-    for (int i = 0; i < msgsize; i++)
+    if (debugMode)
     {
-	debugOut("%.2X ", msg[i]);
+	debugOut("response: ");
+	for (int i = 0; i < msgsize; i++)
+	    debugOut("%.2X ", msg[i]);
+	debugOut("\n");
     }
-    debugOut("\n");
 
     unsigned char c = msg[0];
 
@@ -375,23 +313,25 @@ void jtag2::doJtagCommand(uchar *command, int  commandSize,
 	if (sendJtagCommand(command, commandSize, tryCount, response, responseSize, false))
 	    return;
 
+	if (responseSize > 0)
+	{
+	    sizeseen = responseSize;
+	    code = response[0];
+	    freeFrame(response);
+	    response = NULL;
+	}
+
 	if (!retryOnTimeout)
 	{
 	    if (responseSize == 0)
 		throw jtag_timeout_exception();
 	    else
-		throw jtag_io_exception(response[0]);
+		throw jtag_io_exception(code);
 	}
 
-	if (responseSize > 0 && response[0] > RSP_FAILED)
+	if (responseSize > 0 && code > RSP_FAILED)
 	    // no point in retrying failures other than FAILED
-	    throw jtag_io_exception(response[0]);
-
-	if (responseSize > 0)
-	{
-	    sizeseen = responseSize;
-	    code = response[0];
-	}
+	    throw jtag_io_exception(code);
 
 #ifdef HAVE_LIBUSB
 	if (tryCount == 4 && responseSize == 0 && is_usb)
@@ -421,14 +361,114 @@ void jtag2::doSimpleJtagCommand(uchar command)
 		throw jtag_io_exception();
 	    if (dummy != 1)
 		throw jtag_exception("Unexpected response size in doSimpleJtagCommand");
-	    if (replydummy[0] != RSP_OK)
-		throw jtag_io_exception(replydummy[0]);
-	    delete [] replydummy;
+	    uchar code = replydummy[0];
+	    freeFrame(replydummy);
+	    if (code != RSP_OK)
+		throw jtag_io_exception(code);
 	    return;
 	}
     }
 }
 
+void jtag2::doJtagCommands(pipelinedCommand *cmds, int count)
+{
+    // State of the commands in flight, indexed modulo the window size
+    unsigned short seqnos[MAX_PIPELINED_COMMANDS];
+    bool failed[MAX_PIPELINED_COMMANDS];
+    int sent = 0, oldest = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+	cmds[i].response = NULL;
+	cmds[i].responseSize = 0;
+    }
+
+    try
+    {
+	while (oldest < count)
+	{
+	    // Keep the pipeline filled
+	    while (sent < count && sent - oldest < MAX_PIPELINED_COMMANDS)
+	    {
+		debugOut("\ncommand[0x%02x, seqno %d] (pipelined)\n",
+			 cmds[sent].command[0], command_sequence);
+		seqnos[sent % MAX_PIPELINED_COMMANDS] = command_sequence;
+		failed[sent % MAX_PIPELINED_COMMANDS] = false;
+		sendFrame(cmds[sent].command, cmds[sent].commandSize);
+		if (++command_sequence == 0xffff)
+		    command_sequence = 0;
+		sent++;
+	    }
+
+	    uchar *msg;
+	    unsigned short r_seqno;
+	    int rv = recvFrame(msg, r_seqno);
+
+	    if (rv <= 0)
+		// Timeout or garbage: leave the rest to the retries
+		break;
+
+	    int i;
+	    for (i = oldest; i < sent; i++)
+		if (seqnos[i % MAX_PIPELINED_COMMANDS] == r_seqno &&
+		    cmds[i].response == NULL &&
+		    !failed[i % MAX_PIPELINED_COMMANDS])
+		    break;
+	    if (r_seqno == 0xffff)
+	    {
+		debugOut("\ngot asynchronous event: 0x%02x\n", msg[8]);
+		queueEvent(msg);
+		continue;
+	    }
+	    if (i == sent)
+	    {
+		debugOut("\ngot unexpected seqno %u while pipelining\n",
+			 r_seqno);
+		freeFrame(msg);
+		continue;
+	    }
+
+	    memmove(msg, msg + 8, rv);
+	    debugOut("response[seqno %u]: 0x%02x, %d bytes\n",
+		     r_seqno, msg[0], rv);
+	    if (rv > 0 && msg[0] >= RSP_OK && msg[0] < RSP_FAILED)
+	    {
+		cmds[i].response = msg;
+		cmds[i].responseSize = rv;
+	    }
+	    else
+	    {
+		failed[i % MAX_PIPELINED_COMMANDS] = true;
+		freeFrame(msg);
+	    }
+
+	    while (oldest < sent &&
+		   (cmds[oldest].response != NULL ||
+		    failed[oldest % MAX_PIPELINED_COMMANDS]))
+		oldest++;
+	}
+
+	// Whatever did not succeed goes the slow way, with retries.
+	for (int i = 0; i < count; i++)
+	    if (cmds[i].response == NULL)
+	    {
+		if (i < sent)
+		    debugOut("\nretrying pipelined command %d\n", i);
+		doJtagCommand(cmds[i].command, cmds[i].commandSize,
+			      cmds[i].response, cmds[i].responseSize);
+	    }
+    }
+    catch (jtag_exception&)
+    {
+	for (int i = 0; i < count; i++)
+	{
+	    freeFrame(cmds[i].response);
+	    cmds[i].response = NULL;
+	}
+	throw;
+    }
+}
+
 /** Set PC and JTAG ICE bitrate to BIT_RATE_xxx specified by 'newBitRate' **/
 void jtag2::changeBitRate(int newBitRate)
 {
@@ -560,7 +600,7 @@ bool jtag2::synchroniseAt(int bitrate)
 		}
 	    }
 
-	    delete [] signonmsg;
+	    freeFrame(signonmsg);
 	    return true;
 	}
     }
@@ -652,7 +692,7 @@ void jtag2::deviceAutoConfig(void)
 	if (respSize < 3)
             throw jtag_exception("Invalid response size to PAR_TARGET_SIGNATURE");
 	device_id = resp[1] | (resp[2] << 8);
-	delete [] resp;
+	freeFrame(resp);
 
 	statusOut("Reported debugWire device ID: 0x%0X\n", device_id);
     }
@@ -670,7 +710,7 @@ void jtag2::deviceAutoConfig(void)
 	if (respSize < 5)
             throw jtag_exception("Invalid response size to PAR_TARGET_SIGNATURE");
 	device_id = resp[1] | (resp[2] << 8) | (resp[3] << 16) | resp[4] << 24;
-	delete [] resp;
+	freeFrame(resp);
 
 	debugOut("JTAG id = 0x%0X : Ver = 0x%0x : Device = 0x%0x : Manuf = 0x%0x\n",
 		 device_id,
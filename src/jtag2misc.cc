@@ -61,11 +61,11 @@ void jtag2::setJtagParameter(uchar item, uchar *newValue, int valSize)
         throw;
     }
 
-    delete [] resp;
+    freeFrame(resp);
 }
 
 /*
- * Get a JTAG ICE parameter.  Caller must delete [] the response.  Note
+ * Get a JTAG ICE parameter.  Caller must freeFrame() the response.  Note
  * that the response still includes the response code at index 0 (to be
  * ignored).
  */
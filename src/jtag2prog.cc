@@ -231,6 +231,8 @@ void jtag2::eraseProgramMemory(void)
         // debugWIRE auto-erases when programming
         return;
 
+    flashCachePageAddr = (unsigned int)-1;
+
     if (is_xmega)
     {
         uchar *response;
@@ -257,7 +259,7 @@ void jtag2::eraseProgramMemory(void)
 		    e.what());
 	    throw;
 	}
-        delete [] response;
+        freeFrame(response);
     }
     else
     {
@@ -271,6 +273,12 @@ void jtag2::eraseProgramPage(unsigned long address)
     int respSize;
     uchar command[5] = { CMND_ERASEPAGE_SPM };
 
+    if (proto == PROTO_DW)
+        // debugWIRE auto-erases when programming
+        return;
+
+    flashCachePageAddr = (unsigned int)-1;
+
     command[1] = (address & 0xff000000) >> 24;
     command[2] = (address & 0xff0000) >> 16;
     command[3] = (address & 0xff00) >> 8;
@@ -288,7 +296,13 @@ void jtag2::eraseProgramPage(unsigned long address)
         throw;
     }
 
-    delete [] response;
+    freeFrame(response);
+}
+
+bool jtag2::pageEraseSupported(void)
+{
+    // There is no page erase in megaAVR JTAG programming mode
+    return is_xmega || proto == PROTO_DW;
 }
 
 
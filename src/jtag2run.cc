@@ -60,7 +60,7 @@ unsigned long jtag2::getProgramCounter(void)
     }
 
     unsigned long result = b4_to_u32(response + 1);
-    delete [] response;
+    freeFrame(response);
 
     // The JTAG box sees program memory as 16-bit wide locations. GDB
     // sees bytes. As such, double the PC value.
@@ -89,7 +89,7 @@ void jtag2::setProgramCounter(unsigned long pc)
         throw;
     }
 
-    delete [] response;
+    freeFrame(response);
 
     cached_pc_is_valid = false;
 }
@@ -99,6 +99,8 @@ PRAGMA_DIAG_IGNORED("-Wunused-parameter")
 
 void jtag2::resetProgram(bool possible_nSRST_ignored)
 {
+    invalidateCaches();
+
     if (proto == PROTO_DW) {
 	/* The JTAG ICE mkII and Dragon do not respond correctly to
 	 * the CMND_RESET command while in debugWire mode. */
@@ -110,7 +112,7 @@ void jtag2::resetProgram(bool possible_nSRST_ignored)
 	int respSize;
 
 	doJtagCommand(cmd, 2, resp, respSize);
-	delete [] resp;
+	freeFrame(resp);
 
 	/* Await the BREAK event that is posted by the ICE. */
 	bool bp, gdb;
@@ -127,7 +129,7 @@ void jtag2::interruptProgram(void)
     int respSize;
 
     doJtagCommand(cmd, 2, resp, respSize);
-    delete [] resp;
+    freeFrame(resp);
 
     bool bp, gdb;
     expectEvent(bp, gdb);
@@ -137,6 +139,8 @@ void jtag2::resumeProgram(void)
 {
     xmegaSendBPs();
 
+    invalidateCaches();
+
     doSimpleJtagCommand(CMND_GO);
 
     cached_pc_is_valid = false;
@@ -144,94 +148,106 @@ void jtag2::resumeProgram(void)
 
 void jtag2::expectEvent(bool &breakpoint, bool &gdbInterrupt)
 {
-    uchar *evtbuf;
-    int evtSize;
-    unsigned short seqno;
-
-    evtSize = recvFrame(evtbuf, seqno);
-    if (evtSize >= 0) {
-	// XXX if not event, should push frame back into queue...
-	// We really need a queue of received frames.
+    uchar *evtbuf = dequeueEvent();
+
+    if (evtbuf == NULL)
+    {
+	int evtSize;
+	unsigned short seqno;
+
+	evtSize = recvFrame(evtbuf, seqno);
+	if (evtSize < 0)
+	    return;
 	if (seqno != 0xffff)
+	{
 	    debugOut("Expected event packet, got other response");
-	else if (!nonbreaking_events[evtbuf[8] - EVT_BREAK])
+	    freeFrame(evtbuf);
+	    return;
+	}
+    }
+
+    processEvent(evtbuf, breakpoint, gdbInterrupt);
+    freeFrame(evtbuf);
+}
+
+void jtag2::processEvent(uchar *evtbuf, bool &breakpoint, bool &gdbInterrupt)
+{
+    if (!nonbreaking_events[evtbuf[8] - EVT_BREAK])
+    {
+	switch (evtbuf[8])
 	{
-	    switch (evtbuf[8])
-	    {
-		// Program stopped at some kind of breakpoint.
-		case EVT_BREAK:
-		    cached_pc = 2 * b4_to_u32(evtbuf + 9);
-		    cached_pc_is_valid = true;
-		    /* FALLTHROUGH */
-		case EVT_EXT_RESET:
-		case EVT_PDSB_BREAK:
-		case EVT_PDSMB_BREAK:
-		case EVT_PROGRAM_BREAK:
-		    breakpoint = true;
-		    break;
-
-		case EVT_IDR_DIRTY:
-		    // The program is still running at IDR dirty, so
-		    // pretend a user break;
-		    gdbInterrupt = true;
-		    printf("\nIDR dirty: 0x%02x\n", evtbuf[9]);
-		    break;
-
-		    // Fatal debugWire errors, cannot continue
-		case EVT_ERROR_PHY_FORCE_BREAK_TIMEOUT:
-		case EVT_ERROR_PHY_MAX_BIT_LENGTH_DIFF:
-		case EVT_ERROR_PHY_OPT_RECEIVE_TIMEOUT:
-		case EVT_ERROR_PHY_OPT_RECEIVED_BREAK:
-		case EVT_ERROR_PHY_RECEIVED_BREAK:
-		case EVT_ERROR_PHY_RECEIVE_TIMEOUT:
-		case EVT_ERROR_PHY_RELEASE_BREAK_TIMEOUT:
-		case EVT_ERROR_PHY_SYNC_OUT_OF_RANGE:
-		case EVT_ERROR_PHY_SYNC_TIMEOUT:
-		case EVT_ERROR_PHY_SYNC_TIMEOUT_BAUD:
-		case EVT_ERROR_PHY_SYNC_WAIT_TIMEOUT:
-		    gdbInterrupt = true;
-		    printf("\nFatal debugWIRE communication event: 0x%02x\n",
-			   evtbuf[8]);
-		    break;
-
-		    // Other fatal errors, user could mask them off
-		case EVT_ICE_POWER_ERROR_STATE:
-		    gdbInterrupt = true;
-		    printf("\nJTAG ICE mkII power failure\n");
-		    break;
-
-		case EVT_TARGET_POWER_OFF:
-		    gdbInterrupt = true;
-		    printf("\nTarget power turned off\n");
-		    break;
-
-		case EVT_TARGET_POWER_ON:
-		    gdbInterrupt = true;
-		    printf("\nTarget power returned\n");
-		    break;
-
-		case EVT_TARGET_SLEEP:
-		    gdbInterrupt = true;
-		    printf("\nTarget went to sleep\n");
-		    break;
-
-		case EVT_TARGET_WAKEUP:
-		    gdbInterrupt = true;
-		    printf("\nTarget went out of sleep\n");
-		    break;
-
-		    // Events where we want to continue
-		case EVT_NONE:
-		case EVT_RUN:
-		    break;
-
-		default:
-		    gdbInterrupt = true;
-		    printf("\nUnhandled JTAG ICE mkII event: 0x%0x2\n",
-			   evtbuf[8]);
-	    }
+	    // Program stopped at some kind of breakpoint.
+	    case EVT_BREAK:
+		cached_pc = 2 * b4_to_u32(evtbuf + 9);
+		cached_pc_is_valid = true;
+		/* FALLTHROUGH */
+	    case EVT_EXT_RESET:
+	    case EVT_PDSB_BREAK:
+	    case EVT_PDSMB_BREAK:
+	    case EVT_PROGRAM_BREAK:
+		breakpoint = true;
+		break;
+
+	    case EVT_IDR_DIRTY:
+		// The program is still running at IDR dirty, so
+		// pretend a user break;
+		gdbInterrupt = true;
+		printf("\nIDR dirty: 0x%02x\n", evtbuf[9]);
+		break;
+
+		// Fatal debugWire errors, cannot continue
+	    case EVT_ERROR_PHY_FORCE_BREAK_TIMEOUT:
+	    case EVT_ERROR_PHY_MAX_BIT_LENGTH_DIFF:
+	    case EVT_ERROR_PHY_OPT_RECEIVE_TIMEOUT:
+	    case EVT_ERROR_PHY_OPT_RECEIVED_BREAK:
+	    case EVT_ERROR_PHY_RECEIVED_BREAK:
+	    case EVT_ERROR_PHY_RECEIVE_TIMEOUT:
+	    case EVT_ERROR_PHY_RELEASE_BREAK_TIMEOUT:
+	    case EVT_ERROR_PHY_SYNC_OUT_OF_RANGE:
+	    case EVT_ERROR_PHY_SYNC_TIMEOUT:
+	    case EVT_ERROR_PHY_SYNC_TIMEOUT_BAUD:
+	    case EVT_ERROR_PHY_SYNC_WAIT_TIMEOUT:
+		gdbInterrupt = true;
+		printf("\nFatal debugWIRE communication event: 0x%02x\n",
+		       evtbuf[8]);
+		break;
+
+		// Other fatal errors, user could mask them off
+	    case EVT_ICE_POWER_ERROR_STATE:
+		gdbInterrupt = true;
+		printf("\nJTAG ICE mkII power failure\n");
+		break;
+
+	    case EVT_TARGET_POWER_OFF:
+		gdbInterrupt = true;
+		printf("\nTarget power turned off\n");
+		break;
+
+	    case EVT_TARGET_POWER_ON:
+		gdbInterrupt = true;
+		printf("\nTarget power returned\n");
+		break;
+
+	    case EVT_TARGET_SLEEP:
+		gdbInterrupt = true;
+		printf("\nTarget went to sleep\n");
+		break;
+
+	    case EVT_TARGET_WAKEUP:
+		gdbInterrupt = true;
+		printf("\nTarget went out of sleep\n");
+		break;
+
+		// Events where we want to continue
+	    case EVT_NONE:
+	    case EVT_RUN:
+		break;
+
+	    default:
+		gdbInterrupt = true;
+		printf("\nUnhandled JTAG ICE mkII event: 0x%0x2\n",
+		       evtbuf[8]);
 	}
-	delete [] evtbuf;
     }
 }
 
@@ -246,6 +262,18 @@ bool jtag2::eventLoop(void)
 
     for (;;)
       {
+	  // Events that arrived while a command was being processed
+	  // come first
+	  if (eventQueueCount > 0)
+	    {
+		expectEvent(breakpoint, gdbInterrupt);
+		if (gdbInterrupt)
+		    return false;
+		if (breakpoint)
+		    return true;
+		continue;
+	    }
+
 	  debugOut("Waiting for input.\n");
 
 	  // Check for input from JTAG ICE (breakpoint, sleep, info, power)
@@ -259,11 +287,19 @@ bool jtag2::eventLoop(void)
 	  else
 	    maxfd = jtagBox;
 
-	  int numfds = select(maxfd + 1, &readfds, 0, 0, 0);
+	  // Don't block if gdb or ICE input is already waiting in our
+	  // buffers.
+	  bool gdbPending = gdbFileDescriptor != -1 && gdbInputPending();
+	  bool icePending = receivePending();
+	  struct timeval notime = { 0, 0 };
+
+	  int numfds = select(maxfd + 1, &readfds, 0, 0,
+			      gdbPending || icePending? &notime: 0);
 	  if (numfds < 0)
               throw jtag_exception("GDB/JTAG ICE communications failure");
 
-	  if (gdbFileDescriptor != -1 && FD_ISSET(gdbFileDescriptor, &readfds))
+	  if (gdbPending ||
+	      (gdbFileDescriptor != -1 && FD_ISSET(gdbFileDescriptor, &readfds)))
 	    {
 		int c = getDebugChar();
 		if (c == 3) // interrupt
@@ -275,7 +311,7 @@ bool jtag2::eventLoop(void)
 		    debugOut("Unexpected GDB input `%02x'\n", c);
 	    }
 
-	  if (FD_ISSET(jtagBox, &readfds))
+	  if (icePending || FD_ISSET(jtagBox, &readfds))
 	    {
 		expectEvent(breakpoint, gdbInterrupt);
 	    }
@@ -299,6 +335,7 @@ void jtag2::jtagSingleStep(void)
     xmegaSendBPs();
 
     cached_pc_is_valid = false;
+    invalidateCaches();
 
     do
     {
@@ -312,7 +349,7 @@ void jtag2::jtagSingleStep(void)
                 throw;
             continue;
         }
-	delete [] resp;
+	freeFrame(resp);
         break;
     }
     while (--i >= 0);
@@ -398,12 +435,33 @@ void jtag2::parseEvents(const char *evtlist)
     }
 }
 
+/** Whether queued event frame 'evt' reports the target stopping **/
+static bool isStopEvent(const uchar *evt)
+{
+    switch (evt[8])
+    {
+    case EVT_BREAK:
+    case EVT_EXT_RESET:
+    case EVT_PDSB_BREAK:
+    case EVT_PDSMB_BREAK:
+    case EVT_PROGRAM_BREAK:
+	return true;
+    }
+    return false;
+}
+
 bool jtag2::jtagContinue(void)
 {
     updateBreakpoints(); // download new bp configuration
 
     xmegaSendBPs();
 
+    // A stop reported before this GO is stale; power and sleep events
+    // are still of interest
+    discardEvents(isStopEvent);
+
+    invalidateCaches();
+
     doSimpleJtagCommand(CMND_GO);
 
     return eventLoop();
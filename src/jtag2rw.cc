@@ -89,22 +89,42 @@ uchar jtag2::memorySpace(unsigned long &addr)
 
 uchar *jtag2::jtagRead(unsigned long addr, unsigned int numBytes)
 {
-    uchar *response;
-    int responseSize;
+    uchar *response = new uchar[numBytes > 0? numBytes: 1];
 
     if (numBytes == 0)
     {
-	response = new uchar[1];
 	response[0] = '\0';
 	return response;
     }
 
+    try
+    {
+	jtagRead(addr, numBytes, response);
+    }
+    catch (jtag_exception&)
+    {
+	delete [] response;
+	throw;
+    }
+
+    return response;
+}
+
+void jtag2::jtagRead(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    uchar *response;
+    int responseSize;
+
+    if (numBytes == 0)
+	return;
+
     debugOut("jtagRead ");
     uchar whichSpace = memorySpace(addr);
     bool needProgmode = whichSpace >= MTYPE_FLASH_PAGE &&
         whichSpace < MTYPE_XMEGA_REG;
     unsigned int pageSize = 0;
     unsigned int offset = 0;
+    unsigned int count = numBytes;
     bool wasProgmode = programmingEnabled;
     if (needProgmode && !programmingEnabled)
        enableProgramming();
@@ -120,7 +140,7 @@ uchar *jtag2::jtagRead(unsigned long addr, unsigned int numBytes)
     case MTYPE_SPM:
         offset = addr & 1;
         addr &= ~1;
-	numBytes = (numBytes + 1) & ~1;
+	numBytes = (numBytes + 1 + offset) & ~1;
 	break;
 
     case MTYPE_FLASH_PAGE:
@@ -137,67 +157,86 @@ uchar *jtag2::jtagRead(unsigned long addr, unsigned int numBytes)
 	break;
     }
 
-    uchar command[10] = { CMND_READ_MEMORY };
-    command[1] = whichSpace;
-
     if (pageSize > 0) {
 	if (pageSize > 256)
 	    pageSize = 256;	// more cannot be handled
-	u32_to_b4(command + 2, pageSize);
-	response = new uchar[numBytes];
 
+	// All pages the request touches are fetched with pipelined reads
+	// (except for the one in the page cache), a batch at a time
 	unsigned int mask = pageSize - 1;
 	unsigned int pageAddr = addr & ~mask;
-	unsigned int chunksize = numBytes;
-	unsigned int targetOffset = 0;
+	unsigned long end = addr + numBytes;
 
-	if (addr + chunksize >= pageAddr + pageSize)
-	    // Chunk would cross a page boundary, reduce it
-	    // appropriately.
-	    chunksize -= (addr + numBytes - (pageAddr + pageSize));
 	offset = addr - pageAddr;
-
-	while (numBytes > 0)
+	while (pageAddr < end)
 	{
-	    uchar *resp;
+	    uchar commands[MAX_PIPELINED_COMMANDS][10];
+	    pipelinedCommand cmds[MAX_PIPELINED_COMMANDS];
+	    unsigned int pageAddrs[MAX_PIPELINED_COMMANDS];
+	    int numPages = 0, numCmds = 0;
 
-	    if (pageAddr == *cacheBaseAddr)
+	    for (; numPages < MAX_PIPELINED_COMMANDS &&
+		     pageAddr + numPages * pageSize < end; numPages++)
 	    {
-		// quickly fetch from page cache
-		memcpy(response + targetOffset,
-		       cachePtr + offset,
-		       chunksize);
+		unsigned int a = pageAddr + numPages * pageSize;
+
+		pageAddrs[numPages] = a;
+		if (a == *cacheBaseAddr)
+		    continue;
+		commands[numCmds][0] = CMND_READ_MEMORY;
+		commands[numCmds][1] = whichSpace;
+		u32_to_b4(commands[numCmds] + 2, pageSize);
+		u32_to_b4(commands[numCmds] + 6, a);
+		cmds[numCmds].command = commands[numCmds];
+		cmds[numCmds].commandSize = sizeof commands[numCmds];
+		numCmds++;
 	    }
-	    else
+
+	    try
 	    {
-		// read from device, cache result, and copy over our part
-		u32_to_b4(command + 6, pageAddr);
-                try
-                {
-                    doJtagCommand(command, sizeof command, resp, responseSize, true);
-                }
-                catch (jtag_exception& e)
-                {
-                    fprintf(stderr, "Failed to read target memory space: %s\n",
-                            e.what());
-                    delete [] response;
-                    throw;
-                }
-		memcpy(cachePtr, resp + 1, pageSize);
-		*cacheBaseAddr = pageAddr;
-		memcpy(response + targetOffset,
-		       cachePtr + offset,
-		       chunksize);
-		delete [] resp;
+		doJtagCommands(cmds, numCmds);
+	    }
+	    catch (jtag_exception& e)
+	    {
+		fprintf(stderr, "Failed to read target memory space: %s\n",
+			e.what());
+		throw;
+	    }
+
+	    for (int n = 0, c = 0; n < numPages; n++)
+	    {
+		unsigned int chunksize = pageSize - offset;
+		uchar *page;
+
+		if (chunksize > numBytes)
+		    chunksize = numBytes;
+
+		if (pageAddrs[n] == *cacheBaseAddr)
+		    // quickly fetch from page cache
+		    page = cachePtr;
+		else
+		    page = cmds[c++].response + 1;
+		memcpy(buf, page + offset, chunksize);
+
+		buf += chunksize;
+		numBytes -= chunksize;
+		offset = 0;
 	    }
 
-	    numBytes -= chunksize;
-	    targetOffset += chunksize;
+	    // cache the last page read
+	    if (numCmds > 0)
+	    {
+		memcpy(cachePtr, cmds[numCmds - 1].response + 1, pageSize);
+		*cacheBaseAddr = b4_to_u32(commands[numCmds - 1] + 6);
+	    }
 
-	    chunksize = numBytes > pageSize? pageSize: numBytes;
-	    pageAddr += pageSize;
+	    for (int n = 0; n < numCmds; n++)
+		freeFrame(cmds[n].response);
+	    pageAddr += numPages * pageSize;
 	}
     } else {
+	uchar command[10] = { CMND_READ_MEMORY };
+	command[1] = whichSpace;
 	u32_to_b4(command + 2, numBytes);
 	u32_to_b4(command + 6, addr);
 
@@ -211,16 +250,12 @@ uchar *jtag2::jtagRead(unsigned long addr, unsigned int numBytes)
                     e.what());
             throw;
         }
-	if (offset > 0)
-	    memmove(response, response + 1 + offset, responseSize - 1 - offset);
-	else
-	    memmove(response, response + 1, responseSize - 1);
+	memcpy(buf, response + 1 + offset, count);
+	freeFrame(response);
     }
 
     if (needProgmode && !wasProgmode)
        disableProgramming();
-
-    return response;
 }
 
 void jtag2::jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[])
@@ -259,56 +294,83 @@ void jtag2::jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[])
     case MTYPE_FLASH_PAGE:
     case MTYPE_XMEGA_APP_FLASH:
 	pageSize = deviceDef->flash_page_size;
+	flashCachePageAddr = (unsigned int)-1;
 	break;
 
     case MTYPE_EEPROM_PAGE:
 	pageSize = deviceDef->eeprom_page_size;
+	eepromCachePageAddr = (unsigned int)-1;
 	break;
     }
     unsigned int chunksize = numBytes;
     if (pageSize > 0) {
 	unsigned int mask = pageSize - 1;
 	addr &= ~mask;
-	if (numBytes != pageSize)
-	    throw ("jtagWrite(): numByte does not match page size");
+	if (numBytes % pageSize != 0)
+	    throw jtag_exception("jtagWrite(): numBytes is not a multiple of the page size");
+	chunksize = pageSize;
 	if (pageSize > 256) {
 	    chunksize = 256; // that's all the JTAGICEmkII can handle at a time
 	}
     }
-    uchar *command = new uchar [10 + chunksize];
-    command[0] = CMND_WRITE_MEMORY;
-    command[1] = whichSpace;
-    uchar *bp = buffer;
 
-    do
+    // One command per chunk, sent as pipelined batches.  The commands
+    // of a batch share one buffer from the frame pool, as many as fit
+    // (they must stay intact until the batch is done, for retries).
+    unsigned int cmdSize = 10 + chunksize;
+    int batchSize = FRAME_POOL_BUFSIZE / cmdSize;
+    if (batchSize > MAX_PIPELINED_COMMANDS)
+	batchSize = MAX_PIPELINED_COMMANDS;
+    if (batchSize < 1)
+	batchSize = 1;
+    uchar *commands = allocFrame(batchSize * cmdSize);
+
+    while (numBytes > 0)
     {
-	u32_to_b4(command + 2, chunksize);
-	u32_to_b4(command + 6, addr);
-	memcpy(command + 10, bp, chunksize);
+	pipelinedCommand cmds[MAX_PIPELINED_COMMANDS];
+	int numCmds;
 
-	uchar *response;
-	int responseSize;
+	for (numCmds = 0; numCmds < batchSize && numBytes > 0; numCmds++)
+	{
+	    uchar *command = commands + numCmds * cmdSize;
+	    unsigned int size = numBytes > chunksize? chunksize: numBytes;
+
+	    command[0] = CMND_WRITE_MEMORY;
+	    command[1] = whichSpace;
+	    u32_to_b4(command + 2, size);
+	    u32_to_b4(command + 6, addr);
+	    memcpy(command + 10, buffer, size);
+	    cmds[numCmds].command = command;
+	    cmds[numCmds].commandSize = 10 + size;
+
+	    addr += size;
+	    numBytes -= size;
+	    buffer += size;
+	}
 
 	try
 	{
-	    doJtagCommand(command, 10 + chunksize, response, responseSize);
+	    doJtagCommands(cmds, numCmds);
 	}
 	catch (jtag_exception& e)
 	{
 	    fprintf(stderr, "Failed to write target memory space: %s\n",
 		    e.what());
+	    freeFrame(commands);
 	    throw;
 	}
 
-	delete [] response;
-
-	addr += chunksize;
-	numBytes -= chunksize;
-	bp += chunksize;
-    } while (numBytes != 0);
-
-    delete [] command;
+	for (int n = 0; n < numCmds; n++)
+	    freeFrame(cmds[n].response);
+    }
+    freeFrame(commands);
 
     if (needProgmode && !wasProgmode)
        disableProgramming();
 }
+
+void jtag2::jtagWritePages(unsigned long addr, unsigned int pageSize,
+			   unsigned int numPages, uchar buffer[])
+{
+    jtagWrite(addr, pageSize * numPages, buffer);
+}
@@ -88,37 +88,41 @@
 
 #define MAX_MESSAGE      512
 
-#ifdef HAVE_LIBHIDAPI
-struct hid_thread_data
-{
-  unsigned int max_pkt_size;
-};
-#endif
-
-static int read_ep, write_ep, event_ep, max_xfer;
 #ifdef HAVE_LIBUSB_2_0
 typedef struct libusb20_device usb_dev_t;
 #else
 typedef usb_dev_handle usb_dev_t;
 #endif
 
-static usb_dev_t *udev = NULL;
+/*
+ * The state of the USB connection to one ICE, shared by the jtag
+ * object and its USB thread(s).  All links are chained, so they can
+ * be closed at exit.
+ */
+struct usb_link
+{
+  usb_dev_t *udev;
+  int read_ep, write_ep, event_ep, max_xfer;
+  int usb_interface;
+  int pype[2];
 #ifdef HAVE_LIBHIDAPI
-static hid_device *hdev = NULL;
-static pthread_t htid;
+  hid_device *hdev;
+  pthread_t htid;
+  unsigned int max_pkt_size;
 #endif
-static int pype[2];
-
 #ifdef HAVE_LIBUSB_2_0
-static pthread_t utid;
-static struct libusb20_backend *be;
-static struct libusb20_transfer *xfr_out;
-static struct libusb20_transfer *xfr_in;
-static struct libusb20_transfer *xfr_evt;
+  pthread_t utid;
+  struct libusb20_backend *be;
+  struct libusb20_transfer *xfr_out;
+  struct libusb20_transfer *xfr_in;
+  struct libusb20_transfer *xfr_evt;
 #else
-static pthread_t rtid, wtid, etid;
+  pthread_t rtid, wtid, etid;
 #endif
-static int usb_interface;
+  struct usb_link *next;
+};
+
+static struct usb_link *usb_links;
 
 #ifdef HAVE_LIBUSB_2_0
 /* convert LIBUSB20_ERROR into textual description */
@@ -237,10 +241,10 @@ usb_transfer_msg(uint8_t r)
   return msg;
 }
 
-static void usb20_cleanup(usb_dev_t *d)
+static void usb20_cleanup(struct usb_link *l, usb_dev_t *d)
 {
   libusb20_dev_close(d);
-  libusb20_be_free(be);
+  libusb20_be_free(l->be);
 }
 #endif
 
@@ -250,7 +254,7 @@ static void usb20_cleanup(usb_dev_t *d)
  * device.
  */
 static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
-			  int &usb_interface)
+			  struct usb_link *l)
 {
   char string[256];
 #ifndef HAVE_LIBUSB_2_0
@@ -266,26 +270,26 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
     {
     case EMULATOR_JTAGICE:
       pid = USB_DEVICE_JTAGICEMKII;
-      read_ep = USBDEV_BULK_EP_READ_MKII;
-      write_ep = USBDEV_BULK_EP_WRITE_MKII;
-      event_ep = 0;
-      max_xfer = USBDEV_MAX_XFER_MKII;
+      l->read_ep = USBDEV_BULK_EP_READ_MKII;
+      l->write_ep = USBDEV_BULK_EP_WRITE_MKII;
+      l->event_ep = 0;
+      l->max_xfer = USBDEV_MAX_XFER_MKII;
       break;
 
     case EMULATOR_DRAGON:
       pid = USB_DEVICE_AVRDRAGON;
-      read_ep = USBDEV_BULK_EP_READ_MKII;
-      write_ep = USBDEV_BULK_EP_WRITE_MKII;
-      event_ep = 0;
-      max_xfer = USBDEV_MAX_XFER_MKII;
+      l->read_ep = USBDEV_BULK_EP_READ_MKII;
+      l->write_ep = USBDEV_BULK_EP_WRITE_MKII;
+      l->event_ep = 0;
+      l->max_xfer = USBDEV_MAX_XFER_MKII;
       break;
 
     case EMULATOR_JTAGICE3:
       pid = USB_DEVICE_JTAGICE3;
-      read_ep = USBDEV_BULK_EP_READ_3;
-      write_ep = USBDEV_BULK_EP_WRITE_3;
-      event_ep = USBDEV_EVT_EP_READ_3;
-      max_xfer = USBDEV_MAX_XFER_3;
+      l->read_ep = USBDEV_BULK_EP_READ_3;
+      l->write_ep = USBDEV_BULK_EP_WRITE_3;
+      l->event_ep = USBDEV_EVT_EP_READ_3;
+      l->max_xfer = USBDEV_MAX_XFER_3;
       break;
 
     default:
@@ -327,7 +331,7 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
     }
 
 #ifdef HAVE_LIBUSB_2_0
-  if ((be = libusb20_be_alloc_default()) == NULL)
+  if ((l->be = libusb20_be_alloc_default()) == NULL)
     {
       perror("libusb20_be_alloc()");
       return NULL;
@@ -342,8 +346,7 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
   pdev = NULL;
   bool found = false;
 #ifdef HAVE_LIBUSB_2_0
-  (void)usb_interface;
-  while ((pdev = libusb20_be_device_foreach(be, pdev)) != NULL)
+  while ((pdev = libusb20_be_device_foreach(l->be, pdev)) != NULL)
     {
       struct LIBUSB20_DEVICE_DESC_DECODED *ddp =
       libusb20_dev_get_device_desc(pdev);
@@ -356,7 +359,7 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
 	    {
 	      fprintf(stderr, "cannot open device \"%s\"",
 		      usb_error(rv));
-	      libusb20_be_free(be);
+	      libusb20_be_free(l->be);
 	      return NULL;
 	    }
 
@@ -368,7 +371,7 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
 	    {
 	      fprintf(stderr, "cannot read serial number \"%s\"",
 		      usb_error(rv));
-	      usb20_cleanup(pdev);
+	      usb20_cleanup(l, pdev);
 	      return NULL;
 	    }
 
@@ -457,22 +460,22 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
   if ((rv = libusb20_dev_set_config_index(pdev, 0)) != 0)
     {
       fprintf(stderr, "libusb20_dev_set_config_index: %s\n", usb_error(rv));
-      usb20_cleanup(pdev);
+      usb20_cleanup(l, pdev);
       return NULL;
     }
   /*
    * Two transfers have been requested in libusb20_dev_open() above;
    * obtain the corresponding transfer struct pointers.
    */
-  xfr_out = libusb20_tr_get_pointer(pdev, 0);
-  xfr_in = libusb20_tr_get_pointer(pdev, 1);
-  if (event_ep != 0)
-    xfr_evt = libusb20_tr_get_pointer(pdev, 2);
+  l->xfr_out = libusb20_tr_get_pointer(pdev, 0);
+  l->xfr_in = libusb20_tr_get_pointer(pdev, 1);
+  if (l->event_ep != 0)
+    l->xfr_evt = libusb20_tr_get_pointer(pdev, 2);
 
-  if (xfr_in == NULL || xfr_out == NULL)
+  if (l->xfr_in == NULL || l->xfr_out == NULL)
     {
       fprintf(stderr, "libusb20_tr_get_pointer: %s\n", usb_error(rv));
-      usb20_cleanup(pdev);
+      usb20_cleanup(l, pdev);
       return NULL;
     }
 
@@ -481,36 +484,36 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
    * "in" one for the read endpoint (ep | 0x80), and the event EP
    * for the JTAGICE3 events.
    */
-  if ((rv = libusb20_tr_open(xfr_out, 0, 1, write_ep)) != 0)
+  if ((rv = libusb20_tr_open(l->xfr_out, 0, 1, l->write_ep)) != 0)
     {
       fprintf(stderr, "libusb20_tr_open: %s\n", usb_error(rv));
-      usb20_cleanup(pdev);
+      usb20_cleanup(l, pdev);
       return NULL;
     }
   uint32_t max_packet_l;
-  if ((max_packet_l = libusb20_tr_get_max_packet_length(xfr_out)) < (unsigned)max_xfer)
+  if ((max_packet_l = libusb20_tr_get_max_packet_length(l->xfr_out)) < (unsigned)l->max_xfer)
     {
       statusOut("downgrading max_xfer from %d to %d due to EP 0x%02x's wMaxPacketSize\n",
-		max_xfer, max_packet_l, write_ep);
-      max_xfer = max_packet_l;
+		l->max_xfer, max_packet_l, l->write_ep);
+      l->max_xfer = max_packet_l;
     }
-  if ((rv = libusb20_tr_open(xfr_in, 0, 1, read_ep)) != 0)
+  if ((rv = libusb20_tr_open(l->xfr_in, 0, 1, l->read_ep)) != 0)
     {
       fprintf(stderr, "libusb20_tr_open: %s\n", usb_error(rv));
-      usb20_cleanup(pdev);
+      usb20_cleanup(l, pdev);
       return NULL;
     }
-  if ((max_packet_l = libusb20_tr_get_max_packet_length(xfr_in)) < (unsigned)max_xfer)
+  if ((max_packet_l = libusb20_tr_get_max_packet_length(l->xfr_in)) < (unsigned)l->max_xfer)
     {
       statusOut("downgrading max_xfer from %d to %d due to EP 0x%02x's wMaxPacketSize\n",
-		max_xfer, max_packet_l, read_ep);
-      max_xfer = max_packet_l;
+		l->max_xfer, max_packet_l, l->read_ep);
+      l->max_xfer = max_packet_l;
     }
-  if (event_ep != 0 &&
-      (rv = libusb20_tr_open(xfr_evt, 0, 1, event_ep)) != 0)
+  if (l->event_ep != 0 &&
+      (rv = libusb20_tr_open(l->xfr_evt, 0, 1, l->event_ep)) != 0)
     {
       fprintf(stderr, "libusb20_tr_open: %s\n", usb_error(rv));
-      usb20_cleanup(pdev);
+      usb20_cleanup(l, pdev);
       return NULL;
     }
 #else
@@ -528,22 +531,22 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
                 usb_strerror());
       goto fail;
   }
-  usb_interface = dev->config[0].interface[0].altsetting[0].bInterfaceNumber;
-  if (usb_claim_interface(pdev, usb_interface))
+  l->usb_interface = dev->config[0].interface[0].altsetting[0].bInterfaceNumber;
+  if (usb_claim_interface(pdev, l->usb_interface))
   {
       statusOut("error claiming interface %d: %s\n",
-                usb_interface, usb_strerror());
+                l->usb_interface, usb_strerror());
       goto fail;
   }
   struct usb_endpoint_descriptor *epp = dev->config[0].interface[0].altsetting[0].endpoint;
   for (int i = 0; i < dev->config[0].interface[0].altsetting[0].bNumEndpoints; i++)
   {
-    if ((epp[i].bEndpointAddress == read_ep || epp[i].bEndpointAddress == write_ep) &&
-	epp[i].wMaxPacketSize < max_xfer)
+    if ((epp[i].bEndpointAddress == l->read_ep || epp[i].bEndpointAddress == l->write_ep) &&
+	epp[i].wMaxPacketSize < l->max_xfer)
     {
       statusOut("downgrading max_xfer from %d to %d due to EP 0x%02x's wMaxPacketSize\n",
-		max_xfer, epp[i].wMaxPacketSize, epp[i].bEndpointAddress);
-      max_xfer = epp[i].wMaxPacketSize;
+		l->max_xfer, epp[i].wMaxPacketSize, epp[i].bEndpointAddress);
+      l->max_xfer = epp[i].wMaxPacketSize;
     }
   }
 #endif
@@ -562,12 +565,12 @@ static usb_dev_t *opendev(const char *jtagDeviceName, emulator emu_type,
    * As long as no fixed firmware is known, simply bail out here
    * instead.
    */
-  if (event_ep != 0 &&
-      max_xfer < USBDEV_MAX_XFER_3)
+  if (l->event_ep != 0 &&
+      l->max_xfer < USBDEV_MAX_XFER_3)
     {
       statusOut("Sorry, the JTAGICE3's firmware is broken on USB 1.1 connections\n");
 #ifdef HAVE_LIBUSB_2_0
-      usb20_cleanup(pdev);
+      usb20_cleanup(l, pdev);
 #else
       usb_close(pdev);
 #endif
@@ -738,41 +741,71 @@ static hid_device *openhid(const char *jtagDeviceName, unsigned int &max_pkt_siz
 }
 #endif	// HAVE_LIBHIDAPI
 
+/*
+ * Return how many of the 'len' bytes read from the pipe into 'buf' to
+ * send as one USB transfer: the JTAG ICE mkII frame at the start of
+ * 'buf', or everything if it is something else.  Pipelined commands
+ * may arrive back to back, each frame gets a transfer of its own.
+ * Return 0 if the frame is incomplete, and fits into MAX_MESSAGE
+ * once the rest has been read.
+ */
+static int frame_length(const char *buf, int len)
+{
+  const unsigned char *b = (const unsigned char *)buf;
+
+  if (b[0] != MESSAGE_START)
+    return len;
+  if (len < 8)
+    return 0;
+  if (b[7] != TOKEN)
+    return len;
+
+  unsigned long size = b[3] | (b[4] << 8) | (b[5] << 16) |
+    ((unsigned long)b[6] << 24);
+  if (size + 10 <= (unsigned long)len)
+    return (int)size + 10;
+
+  return size + 10 <= MAX_MESSAGE? 0: len;
+}
+
 #ifdef HAVE_LIBUSB_2_0
 /* USB thread */
-static void *usb_thread(void * data __attribute__((unused)))
+static void *usb_thread(void * data)
 {
+  struct usb_link *l = (struct usb_link *)data;
   struct pollfd fds[2];
 
-  fds[0].fd = pype[0];
+  fds[0].fd = l->pype[0];
   fds[0].events = POLLIN | POLLRDNORM;
-  fds[1].fd = libusb20_dev_get_fd(udev);
+  fds[1].fd = libusb20_dev_get_fd(l->udev);
   // should we also poll for possible USB OUT transfers when splitting
   // one message into multiple packets?
   fds[1].events = POLLIN | POLLRDNORM;
 
+  char buf[MAX_MESSAGE];
+  int buflen = 0;		// start of an incomplete frame
+
   while (1)
     {
-      char buf[MAX_MESSAGE];
       char rbuf[MAX_MESSAGE + sizeof(unsigned int)];
       char ebuf[USBDEV_MAX_EVT_3 + sizeof(unsigned int)];
       int rv;
 
-      if (!libusb20_tr_pending(xfr_in))
+      if (!libusb20_tr_pending(l->xfr_in))
 	{
 	  // setup and start new bulk IN transfer
-	  libusb20_tr_setup_bulk(xfr_in, rbuf + sizeof(unsigned int),
-				 max_xfer, 0);
-	  libusb20_tr_start(xfr_in);
+	  libusb20_tr_setup_bulk(l->xfr_in, rbuf + sizeof(unsigned int),
+				 l->max_xfer, 0);
+	  libusb20_tr_start(l->xfr_in);
 	}
 
-      if (event_ep != 0 &&
-	  !libusb20_tr_pending(xfr_evt))
+      if (l->event_ep != 0 &&
+	  !libusb20_tr_pending(l->xfr_evt))
 	{
 	  // setup and start new bulk IN transfer
-	  libusb20_tr_setup_bulk(xfr_evt, ebuf + sizeof(unsigned int),
+	  libusb20_tr_setup_bulk(l->xfr_evt, ebuf + sizeof(unsigned int),
 				 USBDEV_MAX_EVT_3, 0);
-	  libusb20_tr_start(xfr_evt);
+	  libusb20_tr_start(l->xfr_evt);
 	}
 
       fds[0].revents = fds[1].revents = 0;
@@ -802,24 +835,28 @@ static void *usb_thread(void * data __attribute__((unused)))
       if (fds[0].revents != 0)
 	{
 	  // something is in the pipe there
-	  if ((rv = read(pype[0], buf, MAX_MESSAGE)) > 0)
+	  if ((rv = read(l->pype[0], buf + buflen, MAX_MESSAGE - buflen)) > 0)
 	    {
-	      int offset = 0;
+	      int offset = 0, frame;
 
-	      libusb20_tr_stop(xfr_in);
+	      libusb20_tr_stop(l->xfr_in);
 
-	      while (rv != 0)
+	      rv += buflen;
+	      while (rv != 0 && (frame = frame_length(buf + offset, rv)) != 0)
 		{
+		  rv -= frame;
+		  while (frame != 0)
+		    {
 		  uint32_t amnt, result;
 
-		  if (rv > max_xfer)
-		    amnt = max_xfer;
+		  if (frame > l->max_xfer)
+		    amnt = l->max_xfer;
  		  else
-		    amnt = rv;
+		    amnt = frame;
 		  // right now, we run the bulk writes synchronously
 		  uint8_t xfrstatus;
 
-		  xfrstatus = libusb20_tr_bulk_intr_sync(xfr_out, buf + offset, amnt,
+		  xfrstatus = libusb20_tr_bulk_intr_sync(l->xfr_out, buf + offset, amnt,
 							 &result, 5000);
 		  if (xfrstatus !=
 		      (enum libusb20_transfer_status)LIBUSB20_TRANSFER_COMPLETED)
@@ -834,19 +871,22 @@ static void *usb_thread(void * data __attribute__((unused)))
 			      result, amnt);
 		      pthread_exit((void *)1);
 		    }
-		  if (rv == max_xfer)
+		  if (frame == l->max_xfer)
 		    {
 		      /* send ZLP */
-		      libusb20_tr_bulk_intr_sync(xfr_out, buf, 0,
+		      libusb20_tr_bulk_intr_sync(l->xfr_out, buf, 0,
 						 &result, 5000);
 		    }
-		  rv -= amnt;
+		  frame -= amnt;
 		  offset += amnt;
+		    }
 		}
+	      memmove(buf, buf + offset, rv);
+	      buflen = rv;
 
-	      libusb20_tr_setup_bulk(xfr_in, rbuf + sizeof(unsigned int),
-				     max_xfer, 0);
-	      libusb20_tr_start(xfr_in);
+	      libusb20_tr_setup_bulk(l->xfr_in, rbuf + sizeof(unsigned int),
+				     l->max_xfer, 0);
+	      libusb20_tr_start(l->xfr_in);
 	    }
 	  else if (errno != EINTR && errno != EAGAIN)
 	    {
@@ -859,15 +899,15 @@ static void *usb_thread(void * data __attribute__((unused)))
       if (fds[1].revents != 0)
 	{
 	  // something's available on USB
-	  if ((rv = libusb20_dev_process(udev)) != 0)
+	  if ((rv = libusb20_dev_process(l->udev)) != 0)
 	    // what's up?
 	    continue;
 
-	  if (!libusb20_tr_pending(xfr_in))
+	  if (!libusb20_tr_pending(l->xfr_in))
 	    {
 
-	      uint32_t result = libusb20_tr_get_actual_length(xfr_in);
-	      uint8_t xfrstatus = libusb20_tr_get_status(xfr_in);
+	      uint32_t result = libusb20_tr_get_actual_length(l->xfr_in);
+	      uint8_t xfrstatus = libusb20_tr_get_status(l->xfr_in);
 
 	      if (xfrstatus !=
 		  (enum libusb20_transfer_status)LIBUSB20_TRANSFER_COMPLETED)
@@ -884,15 +924,15 @@ static void *usb_thread(void * data __attribute__((unused)))
 	       * We do it synchronously right now.
 	       */
 	      unsigned int pkt_len = result;
-	      bool needmore = result == (unsigned)max_xfer;
+	      bool needmore = result == (unsigned)l->max_xfer;
 
 	      /* OK, if there is more to read, do so. */
 	      while (needmore)
 		{
 		  int maxlen = MAX_MESSAGE - pkt_len;
-		  if (maxlen > max_xfer)
-		    maxlen = max_xfer;
-		  xfrstatus = libusb20_tr_bulk_intr_sync(xfr_in,
+		  if (maxlen > l->max_xfer)
+		    maxlen = l->max_xfer;
+		  xfrstatus = libusb20_tr_bulk_intr_sync(l->xfr_in,
 							 rbuf + sizeof(unsigned int) + pkt_len,
 							 maxlen, &result, 100);
 
@@ -909,7 +949,7 @@ static void *usb_thread(void * data __attribute__((unused)))
 		      break;
 		    }
 
-		  needmore = rv == max_xfer;
+		  needmore = rv == l->max_xfer;
 		  pkt_len += rv;
 		  if (pkt_len == MAX_MESSAGE)
 		    {
@@ -921,7 +961,7 @@ static void *usb_thread(void * data __attribute__((unused)))
 
 	      unsigned int writesize = pkt_len;
 	      char *writep = rbuf + sizeof(unsigned int);
-	      if (event_ep != 0)
+	      if (l->event_ep != 0)
 		{
 		  /*
 		   * On the JTAGICE3, we prepend the length, so the
@@ -933,7 +973,7 @@ static void *usb_thread(void * data __attribute__((unused)))
 		  writesize += sizeof(unsigned int);
 		}
 
-	      if (write(pype[0], writep, writesize) != writesize)
+	      if (write(l->pype[0], writep, writesize) != writesize)
 		{
 		  fprintf(stderr, "short write to AVaRICE: %s\n",
 			  strerror(errno));
@@ -941,12 +981,12 @@ static void *usb_thread(void * data __attribute__((unused)))
 		}
 	    }
 
-	  if (event_ep != 0 &&
-	      !libusb20_tr_pending(xfr_evt))
+	  if (l->event_ep != 0 &&
+	      !libusb20_tr_pending(l->xfr_evt))
 	    {
 
-	      uint32_t result = libusb20_tr_get_actual_length(xfr_evt);
-	      uint8_t xfrstatus = libusb20_tr_get_status(xfr_evt);
+	      uint32_t result = libusb20_tr_get_actual_length(l->xfr_evt);
+	      uint8_t xfrstatus = libusb20_tr_get_status(l->xfr_evt);
 
 	      if (xfrstatus !=
 		  (enum libusb20_transfer_status)LIBUSB20_TRANSFER_COMPLETED)
@@ -979,7 +1019,7 @@ static void *usb_thread(void * data __attribute__((unused)))
 
 		      ebuf[sizeof(unsigned int)] = TOKEN_EVT3;
 
-		      if (write(pype[0], ebuf, pkt_len + sizeof(unsigned int))
+		      if (write(l->pype[0], ebuf, pkt_len + sizeof(unsigned int))
 			  != pkt_len + sizeof(unsigned int))
 			{
 			  fprintf(stderr, "short write to AVaRICE: %s\n",
@@ -999,39 +1039,50 @@ static void *usb_thread(void * data __attribute__((unused)))
 /* USB writer thread */
 static void *usb_thread_write(void * data)
 {
+  struct usb_link *l = (struct usb_link *)data;
+
+  char buf[MAX_MESSAGE];
+  int buflen = 0;		// start of an incomplete frame
+
   while (1)
     {
-      char buf[MAX_MESSAGE];
       int rv;
 
-      if ((rv = read(pype[0], buf, MAX_MESSAGE)) > 0)
+      if ((rv = read(l->pype[0], buf + buflen, MAX_MESSAGE - buflen)) > 0)
         {
-	  int offset = 0;
+	  int offset = 0, frame;
 
-	  while (rv != 0)
+	  rv += buflen;
+	  while (rv != 0 && (frame = frame_length(buf + offset, rv)) != 0)
 	  {
-	    int amnt, result;
-
-	    if (rv > max_xfer)
-	      amnt = max_xfer;
-	    else
-	      amnt = rv;
-	    result = usb_bulk_write(udev, write_ep,
-				    buf + offset, amnt, 5000);
-	    if (result != amnt)
+	    rv -= frame;
+	    while (frame != 0)
 	    {
-	      fprintf(stderr, "USB bulk write error: %s\n",
-		      usb_strerror());
-	      pthread_exit((void *)1);
-	    }
-	    if (rv == max_xfer)
-	    {
-	      /* send ZLP */
-	      usb_bulk_write(udev, write_ep, buf, 0, 5000);
+	      int amnt, result;
+
+	      if (frame > l->max_xfer)
+		amnt = l->max_xfer;
+	      else
+		amnt = frame;
+	      result = usb_bulk_write(l->udev, l->write_ep,
+				      buf + offset, amnt, 5000);
+	      if (result != amnt)
+	      {
+		fprintf(stderr, "USB bulk write error: %s\n",
+			usb_strerror());
+		pthread_exit((void *)1);
+	      }
+	      if (frame == l->max_xfer)
+	      {
+		/* send ZLP */
+		usb_bulk_write(l->udev, l->write_ep, buf, 0, 5000);
+	      }
+	      frame -= amnt;
+	      offset += amnt;
 	    }
-	    rv -= amnt;
-	    offset += amnt;
 	  }
+	  memmove(buf, buf + offset, rv);
+	  buflen = rv;
           continue;
         }
       else if (errno != EINTR && errno != EAGAIN)
@@ -1046,13 +1097,15 @@ static void *usb_thread_write(void * data)
 /* USB event reader thread (JTAGICE3 only) */
 static void *usb_thread_read(void *data)
 {
+  struct usb_link *l = (struct usb_link *)data;
+
   while (1)
     {
       char buf[MAX_MESSAGE + sizeof(unsigned int)];
       int rv;
 
-      rv = usb_bulk_read(udev, read_ep, buf + sizeof(unsigned int),
-			 max_xfer, 0);
+      rv = usb_bulk_read(l->udev, l->read_ep, buf + sizeof(unsigned int),
+			 l->max_xfer, 0);
       if (rv == 0 || rv == -EINTR || rv == -EAGAIN || rv == -ETIMEDOUT)
       {
 	/* OK, try again */
@@ -1071,15 +1124,15 @@ static void *usb_thread_read(void *data)
 	 * more, until we have either a short read, or a ZLP.
 	 */
 	unsigned int pkt_len = rv;
-	bool needmore = rv == max_xfer;
+	bool needmore = rv == l->max_xfer;
 
 	/* OK, if there is more to read, do so. */
 	while (needmore)
 	{
 	  int maxlen = MAX_MESSAGE - pkt_len;
-	  if (maxlen > max_xfer)
-	    maxlen = max_xfer;
-	  rv = usb_bulk_read(udev, read_ep, buf + sizeof(unsigned int) + pkt_len,
+	  if (maxlen > l->max_xfer)
+	    maxlen = l->max_xfer;
+	  rv = usb_bulk_read(l->udev, l->read_ep, buf + sizeof(unsigned int) + pkt_len,
 			     maxlen, 100);
 
 	  if (rv == -EINTR || rv == -EAGAIN || rv == -ETIMEDOUT)
@@ -1099,7 +1152,7 @@ static void *usb_thread_read(void *data)
 	    pthread_exit((void *)1);
 	  }
 
-	  needmore = rv == max_xfer;
+	  needmore = rv == l->max_xfer;
 	  pkt_len += rv;
 	  if (pkt_len == MAX_MESSAGE)
 	  {
@@ -1111,7 +1164,7 @@ static void *usb_thread_read(void *data)
 
 	unsigned int writesize = pkt_len;
 	char *writep = buf + sizeof(unsigned int);
-	if (event_ep != 0)
+	if (l->event_ep != 0)
 	  {
 	    /*
 	     * On the JTAGICE3, we prepend the message length, so
@@ -1123,7 +1176,7 @@ static void *usb_thread_read(void *data)
 	    writesize += sizeof(unsigned int);
 	  }
 
-	if (write(pype[0], writep, writesize) != writesize)
+	if (write(l->pype[0], writep, writesize) != writesize)
 	{
 	  fprintf(stderr, "short write to AVaRICE: %s\n",
 		  strerror(errno));
@@ -1136,6 +1189,8 @@ static void *usb_thread_read(void *data)
 /* USB reader thread */
 static void *usb_thread_event(void *data)
 {
+  struct usb_link *l = (struct usb_link *)data;
+
   while (1)
     {
       /*
@@ -1145,7 +1200,7 @@ static void *usb_thread_event(void *data)
       char buf[USBDEV_MAX_EVT_3 + sizeof(unsigned int)];
       int rv;
 
-      rv = usb_bulk_read(udev, event_ep, buf + sizeof(unsigned int),
+      rv = usb_bulk_read(l->udev, l->event_ep, buf + sizeof(unsigned int),
 			 USBDEV_MAX_EVT_3, 0);
       if (rv == 0 || rv == -EINTR || rv == -EAGAIN || rv == -ETIMEDOUT)
       {
@@ -1177,7 +1232,7 @@ static void *usb_thread_event(void *data)
 	  memcpy(buf, &pkt_len, sizeof(unsigned int));
 
 	  buf[sizeof(unsigned int)] = TOKEN_EVT3;
-	  if (write(pype[0], buf, pkt_len + sizeof(unsigned int)) !=
+	  if (write(l->pype[0], buf, pkt_len + sizeof(unsigned int)) !=
 	      pkt_len + sizeof(unsigned int))
 	  {
 	    fprintf(stderr, "short write to AVaRICE: %s\n",
@@ -1193,12 +1248,14 @@ static void *usb_thread_event(void *data)
 void jtag::resetUSB(void)
 {
 #ifndef HAVE_LIBUSB_2_0
-  if (udev)
+  struct usb_link *l = usbLink;
+
+  if (l != NULL && l->udev)
     {
-      usb_resetep(udev, read_ep);
-      usb_resetep(udev, write_ep);
-      if (event_ep != 0)
-	usb_resetep(udev, event_ep);
+      usb_resetep(l->udev, l->read_ep);
+      usb_resetep(l->udev, l->write_ep);
+      if (l->event_ep != 0)
+	usb_resetep(l->udev, l->event_ep);
     }
 #endif
 }
@@ -1207,9 +1264,9 @@ void jtag::resetUSB(void)
 static void *hid_thread(void * data)
 {
   struct pollfd fds[1];
-  struct hid_thread_data *hdata = (struct hid_thread_data *)data;
+  struct usb_link *l = (struct usb_link *)data;
 
-  fds[0].fd = pype[0];
+  fds[0].fd = l->pype[0];
   fds[0].events = POLLIN | POLLRDNORM;
 
   debugOut("HID thread started\n");
@@ -1238,11 +1295,11 @@ static void *hid_thread(void * data)
 	  // timed out, so just ping for event
 	  buf[0] = 0;
 	  buf[1] = EDBG_VENDOR_AVR_EVT;
-	  rv = hid_write(hdev, buf, hdata->max_pkt_size + 1);
+	  rv = hid_write(l->hdev, buf, l->max_pkt_size + 1);
 	  if (rv < 0)
 	    throw jtag_exception("Querying for event: hid_write() failed");
 
-	  rv = hid_read_timeout(hdev, buf, hdata->max_pkt_size + 1, 200);
+	  rv = hid_read_timeout(l->hdev, buf, l->max_pkt_size + 1, 200);
 	  if (rv <= 0)
 	  {
 	    debugOut("Querying for event: hid_read() failed (%d)\n",
@@ -1272,7 +1329,7 @@ static void *hid_thread(void * data)
 	  memmove(buf + sizeof(unsigned int), buf + 3, len);
 	  memcpy(buf, &len, sizeof(unsigned int));
 	  // pass event upstream
-	  write(pype[0], buf, len + sizeof(unsigned int));
+	  write(l->pype[0], buf, len + sizeof(unsigned int));
 	  continue;
 	}
 
@@ -1289,7 +1346,7 @@ static void *hid_thread(void * data)
 	{
 	  // something is in the pipe there, presumably a command
 	  // read to offset 5 to leave room for the wrapper
-	  if ((rv = read(pype[0], buf + 5, MAX_MESSAGE)) > 0)
+	  if ((rv = read(l->pype[0], buf + 5, MAX_MESSAGE)) > 0)
 	    {
 	      if (rv < 6)
 	      {
@@ -1299,8 +1356,8 @@ static void *hid_thread(void * data)
 
 	      // used in both, request and reply data
 	      unsigned int npackets =
-	        (rv + hdata->max_pkt_size - 1) /
-	        hdata->max_pkt_size;
+	        (rv + l->max_pkt_size - 1) /
+	        l->max_pkt_size;
 	      unsigned int thispacket = 1;
 	      unsigned int len = rv;
 	      // used in reassembling reply data
@@ -1311,26 +1368,26 @@ static void *hid_thread(void * data)
 		{
 		  if (thispacket != 1)
 		    memmove(buf + 5,
-			    buf + (hdata->max_pkt_size - 4) + 5,
+			    buf + (l->max_pkt_size - 4) + 5,
 			    len);
 
 		  buf[0] = 0;	// libhidapi: no report ID
 		  buf[1] = EDBG_VENDOR_AVR_CMD;
 		  buf[2] = (thispacket << 4) | npackets;
 		  unsigned int cursize =
-		    (len > hdata->max_pkt_size - 4)?
-		    hdata->max_pkt_size - 4: len;
+		    (len > l->max_pkt_size - 4)?
+		    l->max_pkt_size - 4: len;
 		  buf[3] = cursize >> 8;
 		  buf[4] = cursize;
-		  rv = hid_write(hdev, buf, hdata->max_pkt_size + 1);
-		  if ((unsigned)rv != hdata->max_pkt_size + 1)
+		  rv = hid_write(l->hdev, buf, l->max_pkt_size + 1);
+		  if ((unsigned)rv != l->max_pkt_size + 1)
 		    {
 		      debugOut("hid_write: short write, %u vs. %d\n",
-			       hdata->max_pkt_size + 1, rv);
+			       l->max_pkt_size + 1, rv);
 		      goto done;
 		    }
 
-		  rv = hid_read_timeout(hdev, buf, hdata->max_pkt_size + 1, 200);
+		  rv = hid_read_timeout(l->hdev, buf, l->max_pkt_size + 1, 200);
 		  if (rv < 0)
 		    throw jtag_exception("Error reading HID");
 
@@ -1343,11 +1400,11 @@ static void *hid_thread(void * data)
 	      {
 		buf[offset] = 0;
 		buf[offset + 1] = EDBG_VENDOR_AVR_RSP;
-		rv = hid_write(hdev, buf + offset, hdata->max_pkt_size + 1);
+		rv = hid_write(l->hdev, buf + offset, l->max_pkt_size + 1);
 		if (rv < 0)
 		  throw jtag_exception("Querying for response: hid_write() failed");
 
-		rv = hid_read_timeout(hdev, buf + offset, hdata->max_pkt_size + 1, 500);
+		rv = hid_read_timeout(l->hdev, buf + offset, l->max_pkt_size + 1, 500);
 		if (rv <= 0)
 		{
 		  debugOut("Querying for response: hid_read() failed (%d)\n",
@@ -1377,7 +1434,7 @@ static void *hid_thread(void * data)
 		  goto done;
 		}
 		unsigned int len = buf[offset + 2] * 256 + buf[offset + 3];
-		if (len < 5 || len > hdata->max_pkt_size)
+		if (len < 5 || len > l->max_pkt_size)
 		{
 		  debugOut("Querying for response: insane event size %u\n",
 			   len);
@@ -1396,7 +1453,7 @@ static void *hid_thread(void * data)
 		offset += len;
 	      }
 	      // pass reply upstream
-	      write(pype[0], buf, totlength + sizeof(unsigned int));
+	      write(l->pype[0], buf, totlength + sizeof(unsigned int));
 	    done:
 	      ;
 	    }
@@ -1410,76 +1467,95 @@ static void *hid_thread(void * data)
     }
 }
 
-static void
-cleanup_hid(void)
-{
-  hid_close(hdev);
-  hdev = NULL;
-}
 #endif
 
+/*
+ * Close all USB connections at exit.
+ */
 static void
 cleanup_usb(void)
 {
+  for (struct usb_link *l = usb_links; l != NULL; l = l->next)
+    {
+#ifdef HAVE_LIBHIDAPI
+      if (l->hdev != NULL)
+	{
+	  hid_close(l->hdev);
+	  l->hdev = NULL;
+	  continue;
+	}
+#endif
+      if (l->udev == NULL)
+	continue;
 #ifdef HAVE_LIBUSB_2_0
-  usb20_cleanup(udev);
+      usb20_cleanup(l, l->udev);
 #else
-  usb_release_interface(udev, usb_interface);
-  usb_close(udev);
+      usb_release_interface(l->udev, l->usb_interface);
+      usb_close(l->udev);
 #endif
+      l->udev = NULL;
+    }
 }
 
 
 void jtag::openUSB(const char *jtagDeviceName)
 {
-  if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, pype) < 0)
+  struct usb_link *l = new usb_link;
+
+  memset(l, 0, sizeof *l);
+  if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, l->pype) < 0)
+    {
+      delete l;
       throw jtag_exception("cannot create pipe");
+    }
 
   if (emu_type == EMULATOR_EDBG)
     {
 #ifdef HAVE_LIBHIDAPI
-      static struct hid_thread_data hdata;
-      hdev = openhid(jtagDeviceName, hdata.max_pkt_size = 512);
-      if (hdev == NULL)
+      l->hdev = openhid(jtagDeviceName, l->max_pkt_size = 512);
+      if (l->hdev == NULL)
 	throw jtag_exception("cannot open HID");
 
-      pthread_create(&htid, NULL, hid_thread, &hdata);
+      pthread_create(&l->htid, NULL, hid_thread, l);
 #  ifdef __FreeBSD__
-      pthread_set_name_np(htid, "HID thread");
+      pthread_set_name_np(l->htid, "HID thread");
 #  endif
-      atexit(cleanup_hid);
 #else  // !HAVE_LIBHIDAPI
       throw jtag_exception("EDBG/CMSIS-DAP devices require libhidapi support");
 #endif
     }
   else
     {
-      udev = opendev(jtagDeviceName, emu_type, usb_interface);
-      if (udev == NULL)
+      l->udev = opendev(jtagDeviceName, emu_type, l);
+      if (l->udev == NULL)
 	throw jtag_exception("cannot open USB device");
 
 #ifdef HAVE_LIBUSB_2_0
-      pthread_create(&utid, NULL, usb_thread, NULL);
+      pthread_create(&l->utid, NULL, usb_thread, l);
 #  ifdef __FreeBSD__
-      pthread_set_name_np(utid, "USB thread");
+      pthread_set_name_np(l->utid, "USB thread");
 #  endif
 #else
-      pthread_create(&rtid, NULL, usb_thread_read, NULL);
-      pthread_create(&wtid, NULL, usb_thread_write, NULL);
-      if (event_ep != 0)
-	pthread_create(&etid, NULL, usb_thread_event, NULL);
+      pthread_create(&l->rtid, NULL, usb_thread_read, l);
+      pthread_create(&l->wtid, NULL, usb_thread_write, l);
+      if (l->event_ep != 0)
+	pthread_create(&l->etid, NULL, usb_thread_event, l);
 #  ifdef __FreeBSD__
-      pthread_set_name_np(rtid, "USB reader thread");
-      pthread_set_name_np(wtid, "USB writer thread");
-      if (event_ep != 0)
-	pthread_set_name_np(etid, "USB event thread");
+      pthread_set_name_np(l->rtid, "USB reader thread");
+      pthread_set_name_np(l->wtid, "USB writer thread");
+      if (l->event_ep != 0)
+	pthread_set_name_np(l->etid, "USB event thread");
 #  endif
 #endif
-
-      atexit(cleanup_usb);
     }
 
-  jtagBox = pype[1];
+  if (usb_links == NULL)
+    atexit(cleanup_usb);
+  l->next = usb_links;
+  usb_links = l;
+  usbLink = l;
+
+  jtagBox = l->pype[1];
 }
 
 #endif /* HAVE_LIBUSB */
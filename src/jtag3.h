@@ -196,8 +196,6 @@ class jtag3: public jtag
     unsigned long appsize;
     unsigned int device_id;
 
-    unsigned char *cached_event;
-
   public:
     jtag3(const char *dev, char *name, enum debugproto prot = PROTO_JTAG,
 	  bool nsrst = false,
@@ -218,7 +216,6 @@ class jtag3: public jtag
         cached_pc_is_valid = false;
         appsize = 0;
         device_id = 0;
-        cached_event = NULL;
         is_edbg = edbg;
     };
     virtual ~jtag3(void);
@@ -235,6 +232,7 @@ class jtag3: public jtag
     virtual void disableProgramming(void);
     virtual void eraseProgramMemory(void);
     virtual void eraseProgramPage(unsigned long address);
+    virtual bool pageEraseSupported(void);
     virtual void downloadToTarget(const char* filename, bool program, bool verify);
 
     virtual unsigned long getProgramCounter(void);
@@ -246,6 +244,8 @@ class jtag3: public jtag
     virtual bool jtagContinue(void);
 
     virtual uchar *jtagRead(unsigned long addr, unsigned int numBytes);
+    virtual void jtagRead(unsigned long addr, unsigned int numBytes,
+			  uchar *buf);
     virtual void jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[]);
     virtual unsigned int statusAreaAddress(void) const {
         return (is_xmega? 0x3D: 0x5D) + DATA_SPACE_ADDR_OFFSET;
@@ -307,7 +307,7 @@ class jtag3: public jtag
 
 	If a negative response arrived, throw an exception.
 
-	Caller must delete [] the response.
+	Caller must release the response with freeFrame().
     **/
     void doJtagCommand(uchar *command, int  commandSize,
                        const char *name,
@@ -328,8 +328,8 @@ class jtag3: public jtag
     void setJtagParameter(uchar scope, uchar section, uchar item,
                           uchar *newValue, int valSize);
 
-    /** Return value of JTAG ICE parameter 'item'; caller must delete
-        [] resp
+    /** Return value of JTAG ICE parameter 'item'; caller must
+        freeFrame() resp
     **/
     void getJtagParameter(uchar scope, uchar section, uchar item, int length,
                           uchar *&resp);
@@ -346,10 +346,15 @@ class jtag3: public jtag
      **/
     bool eventLoop(void);
 
-    /** Expect an ICE event in the input stream.
+    /** Expect an ICE event, from the event queue if one arrived
+	earlier, otherwise from the input stream.
      **/
     void expectEvent(bool &breakpoint, bool &gdbInterrupt);
 
+    /** Act upon event frame 'evtbuf' (as returned by recvFrame()).
+     **/
+    void processEvent(uchar *evtbuf, bool &breakpoint, bool &gdbInterrupt);
+
     /** Update Xmega breakpoints on target
      **/
     void xmegaSendBPs(void);
@@ -124,7 +124,7 @@ void jtag3::updateBreakpoints(void)
 	  throw;
 	}
 
-	delete [] resp;
+	freeFrame(resp);
       }
 
       // rip breakpoint
@@ -228,7 +228,7 @@ void jtag3::updateBreakpoints(void)
 		  e.what());
 	  throw;
 	}
-	delete [] resp;
+	freeFrame(resp);
 
 	bp[bp_i].icestatus = true;
       }
@@ -273,7 +273,7 @@ void jtag3::xmegaSendBPs(void)
 	    e.what());
     throw;
   }
-  delete [] resp;
+  freeFrame(resp);
 
   xmega_n_bps = 0; // must be set again upon next run
 }
@@ -119,20 +119,23 @@ jtag3::~jtag3(void)
  */
 void jtag3::sendFrame(uchar *command, int commandSize)
 {
-    unsigned char *buf = new unsigned char[commandSize + 4];
+    unsigned char *buf = allocFrame(commandSize + 4);
 
     buf[0] = TOKEN;
     buf[1] = 0;
     u16_to_b2(buf + 2, command_sequence);
     memcpy(buf + 4, command, commandSize);
 
-    for (int i = 0; i < commandSize + 4; i++)
-	debugOut("%.2X ", buf[i]);
-    debugOut("\n");
+    if (debugMode)
+    {
+	for (int i = 0; i < commandSize + 4; i++)
+	    debugOut("%.2X ", buf[i]);
+	debugOut("\n");
+    }
 
     int count = safewrite(buf, commandSize + 4);
 
-    delete [] buf;
+    freeFrame(buf);
 
     if (count < 0)
         throw jtag_exception();
@@ -147,7 +150,7 @@ void jtag3::sendFrame(uchar *command, int commandSize)
  * whether it matches the expected sequence number, including event
  * notification frames (seqno == 0xffff).
  *
- * Caller must eventually free the buffer.
+ * Caller must eventually release the buffer with freeFrame().
  */
 int jtag3::recvFrame(unsigned char *&msg, unsigned short &seqno)
 {
@@ -184,11 +187,14 @@ int jtag3::recvFrame(unsigned char *&msg, unsigned short &seqno)
     if (istoken)
       tempbuf[0] = TOKEN;
 
-    debugOut("read: ");
-    for (l = 0; l < rv; l++) {
-      debugOut(" %02x", tempbuf[l]);
+    if (debugMode)
+    {
+      debugOut("read: ");
+      for (l = 0; l < rv; l++) {
+        debugOut(" %02x", tempbuf[l]);
+      }
+      debugOut("\n");
     }
-    debugOut("\n");
 
     if (istoken)
     {
@@ -196,7 +202,7 @@ int jtag3::recvFrame(unsigned char *&msg, unsigned short &seqno)
       debugOut("Event serial 0x%04x\n", serial);
 
       rv -= 4;
-      msg = new unsigned char[rv];
+      msg = allocFrame(rv);
       seqno = 0xffff;
       memcpy(msg, tempbuf + 4, rv);
 
@@ -206,7 +212,7 @@ int jtag3::recvFrame(unsigned char *&msg, unsigned short &seqno)
     {
       seqno = tempbuf[1] + (tempbuf[2] << 8);
       rv -= 3;
-      msg = new unsigned char[rv];
+      msg = allocFrame(rv);
       memcpy(msg, tempbuf + 3, rv);
 
       return rv;
@@ -229,7 +235,7 @@ int jtag3::recvFrame(unsigned char *&msg, unsigned short &seqno)
 
 /*
  * Try receiving frames, until we get the reply we are expecting.
- * Caller must delete[] the msg after processing it.
+ * Caller must freeFrame() the msg after processing it.
  */
 int jtag3::recv(uchar *&msg)
 {
@@ -249,17 +255,14 @@ int jtag3::recv(uchar *&msg)
 	if (r_seqno == 0xffff) {
 	    debugOut("\ngot asynchronous event: 0x%02x, 0x%02x\n",
 		     msg[0], msg[1]);
-	    if (cached_event == NULL)
-	    {
-	      cached_event = msg;
-	      // do *not* delete[] it here
-	      continue;
-	    }
+	    // expectEvent() picks it up from there
+	    queueEvent(msg);
+	    continue;
 	} else {
 	    debugOut("\ngot wrong sequence number, %u != %u\n",
 		     r_seqno, command_sequence);
 	}
-	delete [] msg;
+	freeFrame(msg);
     }
 }
 
@@ -270,7 +273,7 @@ int jtag3::recv(uchar *&msg)
     positive returns true, otherwise returns false.
 
     If response is positive, message (including response code) is
-    returned in &msg, caller must delete [] it.  The message size is
+    returned in &msg, caller must freeFrame() it.  The message size is
     returned in &msgsize.
 **/
 
@@ -287,12 +290,13 @@ bool jtag3::sendJtagCommand(uchar *command, int commandSize,
     if (msgsize < 1)
 	return false;
 
-    debugOut("response: ");
-    for (int i = 0; i < msgsize; i++)
+    if (debugMode)
     {
-	debugOut("%.2X ", msg[i]);
+	debugOut("response: ");
+	for (int i = 0; i < msgsize; i++)
+	    debugOut("%.2X ", msg[i]);
+	debugOut("\n");
     }
-    debugOut("\n");
 
     unsigned char c = msg[1];
 
@@ -311,9 +315,15 @@ void jtag3::doJtagCommand(uchar *command, int  commandSize,
         return;
 
     if (responseSize == 0)
+    {
+        response = NULL;
         throw jtag_timeout_exception();
-    else
-        throw jtag3_io_exception(response[3]);
+    }
+
+    uchar code = response[3];
+    freeFrame(response);
+    response = NULL;
+    throw jtag3_io_exception(code);
 }
 
 void jtag3::doSimpleJtagCommand(uchar command, const char *name, uchar scope)
@@ -334,14 +344,16 @@ void jtag3::doSimpleJtagCommand(uchar command, const char *name, uchar scope)
 		throw jtag_io_exception();
 	    if (dummy < 3)
 		throw jtag_exception("Unexpected response size in doSimpleJtagCommand");
-	    if (replydummy[1] != RSP3_OK)
+	    uchar status = replydummy[1];
+	    uchar code = dummy >= 4? replydummy[3]: 0;
+	    freeFrame(replydummy);
+	    if (status != RSP3_OK)
 	      {
-		if (replydummy[1] < RSP3_FAILED)
+		if (status < RSP3_FAILED)
 		  throw jtag_exception("Unexpected positive reply in doSimpleJtagCommand");
 		else
-		  throw jtag_io_exception(dummy >= 4? replydummy[3]: 0);
+		  throw jtag_io_exception(code);
 	      }
-	    delete [] replydummy;
 	    return;
 	}
     }
@@ -440,7 +452,7 @@ void jtag3::startJtagLink(void)
     resp[respsize - 3] = 0;
     statusOut("Found a device, serial number: %s\n", resp);
   }
-  delete [] resp;
+  freeFrame(resp);
 
   getJtagParameter(SCOPE_GENERAL, 0, PARM3_HW_VER, 5, resp);
 
@@ -448,7 +460,7 @@ void jtag3::startJtagLink(void)
   debugOut("ICE firmware version: %d.%02d (rel. %d)\n",
 	   resp[4], resp[5], (resp[6] | (resp[7] << 8)));
 
-  delete[] resp;
+  freeFrame(resp);
 
   uchar paramdata[1];
 
@@ -493,7 +505,7 @@ void jtag3::startJtagLink(void)
   if (resp[1] == RSP3_DATA && respsize >= 6)
   {
     unsigned int did = resp[3] | (resp[4] << 8) | (resp[5] << 16) | resp[6] << 24;
-    delete [] resp;
+    freeFrame(resp);
 
     if (proto == PROTO_JTAG)
     {
@@ -513,7 +525,7 @@ void jtag3::startJtagLink(void)
   }
   else
   {
-    delete [] resp;
+    freeFrame(resp);
 
     /* Read in the JTAG device ID to determine device */
     uchar cmd[] = { SCOPE_AVR, CMD3_DEVICE_ID, 0 };
@@ -522,7 +534,7 @@ void jtag3::startJtagLink(void)
       doJtagCommand(cmd, sizeof cmd, "device ID", resp, respsize);
 
       unsigned int did = resp[3] | (resp[4] << 8) | (resp[5] << 16) | resp[6] << 24;
-      delete [] resp;
+      freeFrame(resp);
 
       debugOut("Device ID = 0x%0X : Ver = 0x%0x : Device = 0x%0x : Manuf = 0x%0x\n",
 	       did,
@@ -738,7 +750,7 @@ void jtag3::initJtagOnChipDebugging(unsigned long bitrate)
         int respsize;
 
         doJtagCommand(cmd, sizeof cmd, "start debugging", resp, respsize);
-        delete [] resp;
+        freeFrame(resp);
     }
 
     // Sometimes (like, after just enabling the OCDEN fuse), the first
@@ -60,11 +60,11 @@ void jtag3::setJtagParameter(uchar scope, uchar section, uchar item,
     throw;
   }
 
-  delete [] resp;
+  freeFrame(resp);
 }
 
 /*
- * Get a JTAG ICE parameter.  Caller must delete [] the response.  Note
+ * Get a JTAG ICE parameter.  Caller must freeFrame() the response.  Note
  * that the actual response data returned starts at offset 2.
  */
 void jtag3::getJtagParameter(uchar scope, uchar section, uchar item, int length,
@@ -94,7 +94,7 @@ void jtag3::getJtagParameter(uchar scope, uchar section, uchar item, int length,
   {
     debugOut("unexpected response to get parameter command: 0x%02x\n",
 	     resp[1]);
-    delete [] resp;
+    freeFrame(resp);
     throw jtag_exception("unexpected response to get parameter command");
   }
 }
@@ -65,6 +65,8 @@ void jtag3::eraseProgramMemory(void)
         // debugWIRE auto-erases when programming
         return;
 
+    flashCachePageAddr = (unsigned int)-1;
+
     uchar *resp;
     int respsize;
     uchar buf[8];
@@ -77,7 +79,7 @@ void jtag3::eraseProgramMemory(void)
 
     doJtagCommand(buf, 8, "chip erase", resp, respsize);
 
-    delete [] resp;
+    freeFrame(resp);
 }
 
 void jtag3::eraseProgramPage(unsigned long address)
@@ -86,6 +88,12 @@ void jtag3::eraseProgramPage(unsigned long address)
     int respsize;
     uchar buf[8];
 
+    if (proto == PROTO_DW)
+        // debugWIRE auto-erases when programming
+        return;
+
+    flashCachePageAddr = (unsigned int)-1;
+
     buf[0] = SCOPE_AVR;
     buf[1] = CMD3_ERASE_MEMORY;
     buf[2] = 0;
@@ -102,7 +110,13 @@ void jtag3::eraseProgramPage(unsigned long address)
 
     doJtagCommand(buf, 8, "page erase", resp, respsize);
 
-    delete [] resp;
+    freeFrame(resp);
+}
+
+bool jtag3::pageEraseSupported(void)
+{
+    // There is no page erase in megaAVR JTAG programming mode
+    return is_xmega || proto == PROTO_DW;
 }
 
 
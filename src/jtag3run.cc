@@ -73,7 +73,7 @@ unsigned long jtag3::getProgramCounter(void)
     }
 
   unsigned long result = b4_to_u32(resp + 3);
-  delete [] resp;
+  freeFrame(resp);
 
   // The JTAG box sees program memory as 16-bit wide locations. GDB
   // sees bytes. As such, double the PC value.
@@ -102,7 +102,7 @@ void jtag3::setProgramCounter(unsigned long pc)
       throw;
     }
 
-  delete [] resp;
+  freeFrame(resp);
 
   cached_pc_is_valid = false;
 }
@@ -116,8 +116,10 @@ void jtag3::resetProgram(bool possible_nSRST_ignored)
   uchar *resp;
   int respsize;
 
+  invalidateCaches();
+
   doJtagCommand(cmd, sizeof cmd, "reset", resp, respsize);
-  delete [] resp;
+  freeFrame(resp);
 
   /* Await the BREAK event that is posted by the ICE. */
   bool bp, gdb;
@@ -137,7 +139,7 @@ void jtag3::interruptProgram(void)
   int respsize;
 
   doJtagCommand(cmd, sizeof cmd, "stop", resp, respsize);
-  delete [] resp;
+  freeFrame(resp);
 
   bool bp, gdb;
   expectEvent(bp, gdb);
@@ -147,6 +149,8 @@ void jtag3::resumeProgram(void)
 {
   xmegaSendBPs();
 
+  invalidateCaches();
+
   doSimpleJtagCommand(CMD3_CLEANUP, "cleanup");
 
   doSimpleJtagCommand(CMD3_GO, "go");
@@ -156,24 +160,18 @@ void jtag3::resumeProgram(void)
 
 void jtag3::expectEvent(bool &breakpoint, bool &gdbInterrupt)
 {
-  uchar *evtbuf;
+  uchar *evtbuf = dequeueEvent();
   int evtsize;
   unsigned short seqno;
 
-  if (cached_event != NULL)
-  {
-      evtbuf = cached_event;
-      cached_event = NULL;
-  }
-  else
+  if (evtbuf == NULL)
   {
       evtsize = recvFrame(evtbuf, seqno);
       if (evtsize > 0) {
-          // XXX if not event, should push frame back into queue...
-          // We really need a queue of received frames.
           if (seqno != 0xffff)
           {
               debugOut("Expected event packet, got other response");
+              freeFrame(evtbuf);
               return;
           }
       }
@@ -184,6 +182,12 @@ void jtag3::expectEvent(bool &breakpoint, bool &gdbInterrupt)
       }
   }
 
+  processEvent(evtbuf, breakpoint, gdbInterrupt);
+  freeFrame(evtbuf);
+}
+
+void jtag3::processEvent(uchar *evtbuf, bool &breakpoint, bool &gdbInterrupt)
+{
   breakpoint = gdbInterrupt = false;
 
   switch ((evtbuf[0] << 8) | evtbuf[1])
@@ -249,8 +253,6 @@ void jtag3::expectEvent(bool &breakpoint, bool &gdbInterrupt)
           statusOut("\nUnhandled JTAGICE3 event: 0x%02x, 0x%02x\n",
                     evtbuf[0], evtbuf[1]);
   }
-
-  delete [] evtbuf;
 }
 
 bool jtag3::eventLoop(void)
@@ -264,6 +266,18 @@ bool jtag3::eventLoop(void)
 
     for (;;)
       {
+	  // Events that arrived while a command was being processed
+	  // come first
+	  if (eventQueueCount > 0)
+	    {
+	      expectEvent(breakpoint, gdbInterrupt);
+	      if (gdbInterrupt)
+		  return false;
+	      if (breakpoint)
+		  return true;
+	      continue;
+	    }
+
 	  debugOut("Waiting for input.\n");
 
 	  // Check for input from JTAG ICE (breakpoint, sleep, info, power)
@@ -277,11 +291,19 @@ bool jtag3::eventLoop(void)
 	  else
 	    maxfd = jtagBox;
 
-	  int numfds = select(maxfd + 1, &readfds, 0, 0, 0);
+	  // Don't block if gdb or ICE input is already waiting in our
+	  // buffers.
+	  bool gdbPending = gdbFileDescriptor != -1 && gdbInputPending();
+	  bool icePending = receivePending();
+	  struct timeval notime = { 0, 0 };
+
+	  int numfds = select(maxfd + 1, &readfds, 0, 0,
+			      gdbPending || icePending? &notime: 0);
 	  if (numfds < 0)
               throw jtag_exception("GDB/JTAG ICE communications failure");
 
-	  if (gdbFileDescriptor != -1 && FD_ISSET(gdbFileDescriptor, &readfds))
+	  if (gdbPending ||
+	      (gdbFileDescriptor != -1 && FD_ISSET(gdbFileDescriptor, &readfds)))
 	    {
 		int c = getDebugChar();
 		if (c == 3) // interrupt
@@ -293,7 +315,7 @@ bool jtag3::eventLoop(void)
 		    debugOut("Unexpected GDB input `%02x'\n", c);
 	    }
 
-	  if (FD_ISSET(jtagBox, &readfds))
+	  if (icePending || FD_ISSET(jtagBox, &readfds))
 	    {
 	      expectEvent(breakpoint, gdbInterrupt);
 	    }
@@ -317,17 +339,18 @@ void jtag3::jtagSingleStep(void)
   xmegaSendBPs();
 
   cached_pc_is_valid = false;
+  invalidateCaches();
 
   try
     {
       doJtagCommand(cmd, sizeof cmd, "single-step", resp, respsize);
+      freeFrame(resp);
     }
   catch (jtag_io_exception& e)
     {
       if (e.get_response() != RSP3_FAIL_WRONG_MODE)
 	throw;
     }
-  delete [] resp;
 
   bool bp, gdb;
   expectEvent(bp, gdb);
@@ -386,17 +409,23 @@ void jtag3::parseEvents(const char *evtlist)
 #endif
 }
 
+/** Whether queued event frame 'evt' reports the target stopping **/
+static bool isStopEvent(const uchar *evt)
+{
+  return evt[0] == SCOPE_AVR && evt[1] == EVT3_BREAK;
+}
+
 bool jtag3::jtagContinue(void)
 {
   updateBreakpoints(); // download new bp configuration
 
   xmegaSendBPs();
 
-  if (cached_event != NULL)
-  {
-      delete [] cached_event;
-      cached_event = NULL;
-  }
+  // A stop reported before this GO is stale; power and sleep events
+  // are still of interest
+  discardEvents(isStopEvent);
+
+  invalidateCaches();
 
   doSimpleJtagCommand(CMD3_GO, "go");
 
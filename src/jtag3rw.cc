@@ -87,22 +87,42 @@ uchar jtag3::memorySpace(unsigned long &addr)
 
 uchar *jtag3::jtagRead(unsigned long addr, unsigned int numBytes)
 {
-    uchar *response;
-    int responsesize;
+    uchar *response = new uchar[numBytes > 0? numBytes: 1];
 
     if (numBytes == 0)
     {
-	response = new uchar[1];
 	response[0] = '\0';
 	return response;
     }
 
+    try
+    {
+	jtagRead(addr, numBytes, response);
+    }
+    catch (jtag_exception&)
+    {
+	delete [] response;
+	throw;
+    }
+
+    return response;
+}
+
+void jtag3::jtagRead(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    uchar *response;
+    int responsesize;
+
+    if (numBytes == 0)
+	return;
+
     debugOut("jtagRead ");
     uchar whichSpace = memorySpace(addr);
     bool needProgmode = whichSpace >= MTYPE_FLASH_PAGE &&
         whichSpace < MTYPE_XMEGA_REG;
     unsigned int pageSize = 0;
     unsigned int offset = 0;
+    unsigned int count = numBytes;
     bool wasProgmode = programmingEnabled;
     if (needProgmode && !programmingEnabled)
        enableProgramming();
@@ -118,7 +138,7 @@ uchar *jtag3::jtagRead(unsigned long addr, unsigned int numBytes)
     case MTYPE_SPM:
         offset = addr & 1;
         addr &= ~1;
-	numBytes = (numBytes + 1) & ~1;
+	numBytes = (numBytes + 1 + offset) & ~1;
 	break;
 
     case MTYPE_FLASH_PAGE:
@@ -143,7 +163,6 @@ uchar *jtag3::jtagRead(unsigned long addr, unsigned int numBytes)
 
     if (pageSize > 0) {
 	u32_to_b4(cmd + 8, pageSize);
-	response = new uchar[numBytes];
 
 	unsigned int mask = pageSize - 1;
 	unsigned int pageAddr = addr & ~mask;
@@ -163,7 +182,7 @@ uchar *jtag3::jtagRead(unsigned long addr, unsigned int numBytes)
 	    if (pageAddr == *cacheBaseAddr)
 	    {
 		// quickly fetch from page cache
-		memcpy(response + targetOffset,
+		memcpy(buf + targetOffset,
 		       cachePtr + offset,
 		       chunksize);
 	    }
@@ -179,15 +198,14 @@ uchar *jtag3::jtagRead(unsigned long addr, unsigned int numBytes)
                 {
                     fprintf(stderr, "Failed to read target memory space: %s\n",
                             e.what());
-                    delete [] response;
                     throw;
                 }
 		memcpy(cachePtr, resp + 3, pageSize);
 		*cacheBaseAddr = pageAddr;
-		memcpy(response + targetOffset,
+		memcpy(buf + targetOffset,
 		       cachePtr + offset,
 		       chunksize);
-		delete [] resp;
+		freeFrame(resp);
 	    }
 
 	    numBytes -= chunksize;
@@ -225,16 +243,12 @@ uchar *jtag3::jtagRead(unsigned long addr, unsigned int numBytes)
                     e.what());
             throw;
         }
-	if (offset > 0)
-	    memmove(response, response + 3 + offset, responsesize - 1 - offset);
-	else
-	    memmove(response, response + 3, responsesize - 1);
+	memcpy(buf, response + 3 + offset, count);
+	freeFrame(response);
     }
 
     if (needProgmode && !wasProgmode)
        disableProgramming();
-
-    return response;
 }
 
 void jtag3::jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[])
@@ -272,10 +286,12 @@ void jtag3::jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[])
     {
     case MTYPE_FLASH_PAGE:
 	pageSize = deviceDef->flash_page_size;
+	flashCachePageAddr = (unsigned int)-1;
 	break;
 
     case MTYPE_EEPROM_PAGE:
 	pageSize = deviceDef->eeprom_page_size;
+	eepromCachePageAddr = (unsigned int)-1;
 	break;
     }
     if (pageSize > 0) {
@@ -313,7 +329,7 @@ void jtag3::jtagWrite(unsigned long addr, unsigned int numBytes, uchar buffer[])
                 e.what());
         throw;
     }
-    delete [] response;
+    freeFrame(response);
 
     if (needProgmode && !wasProgmode)
        disableProgramming();
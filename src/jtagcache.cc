@@ -0,0 +1,414 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file implements the target memory cache of class "jtag".
+ *
+ * GDB tends to read the same small pieces of data memory over and
+ * over again (backtraces, "display" expressions), each one costing
+ * an ICE round trip.  While the target is halted, data memory cannot
+ * change behind our back, so it is cached in lines of
+ * MEMCACHE_LINESIZE bytes.  The cache is direct mapped; each line
+ * carries one valid and one dirty bit per byte.
+ *
+ * SRAM writes are collected in the cache and written back before the
+ * target executes code again.  I/O registers are only cached if the
+ * device has an I/O register description, and the line does not hold
+ * any register flagged IO_REG_RSE (reading it has side effects).  As
+ * the description does not flag every such register (SPDR, OCDR), an
+ * I/O line is never filled as a whole: only the bytes asked for are
+ * read.  Writes to I/O registers go to the ICE, and drop the cached
+ * bytes.  EEPROM is cached write-through.
+ *
+ * After gdb downloaded a program, the flash image is kept as a shadow
+ * of the flash contents, so gdb's compare-sections and disassembly do
+ * not have to read it back through the ICE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avarice.h"
+#include "jtag.h"
+
+enum {
+    MEMCACHE_NONE,		// not cached, always talk to the ICE
+    MEMCACHE_WRITETHROUGH,	// cached, but writes go to the ICE
+    MEMCACHE_WRITEBACK,		// cached, writes are buffered
+    MEMCACHE_IO,		// only the bytes read are cached, writes
+				// go to the ICE
+};
+
+/** Return the byte mask for 'count' bytes starting at 'offset' **/
+static unsigned long lineMask(unsigned int offset, unsigned int count)
+{
+    unsigned long mask;
+
+    if (count >= MEMCACHE_LINESIZE)
+	mask = 0xffffffffUL;
+    else
+	mask = (1UL << count) - 1;
+
+    return (mask << offset) & 0xffffffffUL;
+}
+
+static memcache_line *cacheSlot(memcache_line *cache, unsigned long lineAddr)
+{
+    return &cache[(lineAddr / MEMCACHE_LINESIZE) % MEMCACHE_LINES];
+}
+
+/** Decide how the line at 'lineAddr' may be cached (MEMCACHE_*). **/
+int jtag::memCachePolicy(unsigned long lineAddr)
+{
+    if (deviceDef == NULL)
+	return MEMCACHE_NONE;
+
+    unsigned long space = lineAddr & ADDR_SPACE_MASK;
+    unsigned long offset = lineAddr & ~ADDR_SPACE_MASK;
+
+    if (space == EEPROM_SPACE_ADDR_OFFSET)
+    {
+	unsigned long size = deviceDef->eeprom_page_size *
+	    deviceDef->eeprom_page_count;
+
+	return offset + MEMCACHE_LINESIZE <= size?
+	    MEMCACHE_WRITETHROUGH: MEMCACHE_NONE;
+    }
+
+    if (space != DATA_SPACE_ADDR_OFFSET)
+	return MEMCACHE_NONE;
+
+    unsigned int sramStart = deviceDef->dev_desc2.uiSramStartAddr[0] |
+	deviceDef->dev_desc2.uiSramStartAddr[1] << 8;
+    if (sramStart == 0)
+	// be conservative: assume extended I/O up to 0xff
+	sramStart = is_xmega? 0x2000: 0x100;
+
+    if (offset >= sramStart)
+	return MEMCACHE_WRITEBACK;
+
+    gdb_io_reg_def_type *io_reg_defs = deviceDef->io_reg_defs;
+    if (io_reg_defs == NULL)
+	return MEMCACHE_NONE;
+
+    for (int i = 0; io_reg_defs[i].name; i++)
+	if ((io_reg_defs[i].flags & IO_REG_RSE) &&
+	    io_reg_defs[i].reg_addr >= offset &&
+	    io_reg_defs[i].reg_addr < offset + MEMCACHE_LINESIZE)
+	    return MEMCACHE_NONE;
+
+    return MEMCACHE_IO;
+}
+
+void jtag::uncachedRead(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    unsigned int maxchunk = maxMemoryTransfer();
+
+    while (numBytes > 0)
+    {
+	unsigned int chunk = numBytes > maxchunk? maxchunk: numBytes;
+
+	jtagRead(addr, chunk, buf);
+
+	addr += chunk;
+	buf += chunk;
+	numBytes -= chunk;
+    }
+}
+
+void jtag::uncachedWrite(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    unsigned int maxchunk = maxMemoryTransfer();
+
+    while (numBytes > 0)
+    {
+	unsigned int chunk = numBytes > maxchunk? maxchunk: numBytes;
+
+	jtagWrite(addr, chunk, buf);
+
+	addr += chunk;
+	buf += chunk;
+	numBytes -= chunk;
+    }
+}
+
+/** Write the dirty bytes of 'line' to the target, in runs of
+    consecutive bytes. **/
+void jtag::memCacheWriteBack(memcache_line *line)
+{
+    unsigned int i = 0;
+
+    while (line->dirty != 0 && i < MEMCACHE_LINESIZE)
+    {
+	if (!(line->dirty & (1UL << i)))
+	{
+	    i++;
+	    continue;
+	}
+
+	unsigned int start = i;
+	while (i < MEMCACHE_LINESIZE && (line->dirty & (1UL << i)))
+	    i++;
+
+	debugOut("memory cache: write back %d bytes at 0x%lx\n",
+		 i - start, line->addr + start);
+	// clear first, so a failing write is not retried forever
+	line->dirty &= ~lineMask(start, i - start);
+	jtagWrite(line->addr + start, i - start, line->data + start);
+    }
+}
+
+/** Fetch 'numLines' consecutive lines starting at 'lineAddr' from the
+    target with a single read.  Dirty bytes already in the cache take
+    precedence over the target's contents. **/
+void jtag::memCacheFill(unsigned long lineAddr, unsigned int numLines)
+{
+    unsigned int size = numLines * MEMCACHE_LINESIZE;
+    uchar buf[MEMCACHE_LINES * MEMCACHE_LINESIZE];
+
+    debugOut("memory cache: fill %d bytes at 0x%lx\n", size, lineAddr);
+    uncachedRead(lineAddr, size, buf);
+
+    for (unsigned int n = 0; n < numLines; n++)
+    {
+	unsigned long addr = lineAddr + n * MEMCACHE_LINESIZE;
+	memcache_line *line = cacheSlot(memCache, addr);
+	uchar *src = buf + n * MEMCACHE_LINESIZE;
+
+	if (line->valid != 0 && line->addr != addr)
+	{
+	    memCacheWriteBack(line);
+	    line->valid = 0;
+	}
+	if (line->valid == 0)
+	{
+	    line->addr = addr;
+	    line->dirty = 0;
+	}
+
+	for (unsigned int i = 0; i < MEMCACHE_LINESIZE; i++)
+	    if (!(line->dirty & (1UL << i)))
+		line->data[i] = src[i];
+	line->valid = lineMask(0, MEMCACHE_LINESIZE);
+    }
+}
+
+/** Fetch the bytes in 'mask' of the line at 'lineAddr' that are not
+    cached yet, and nothing else. **/
+void jtag::memCacheFillBytes(unsigned long lineAddr, unsigned long mask)
+{
+    memcache_line *line = cacheSlot(memCache, lineAddr);
+
+    if (line->valid != 0 && line->addr != lineAddr)
+    {
+	memCacheWriteBack(line);
+	line->valid = 0;
+    }
+    if (line->valid == 0)
+    {
+	line->addr = lineAddr;
+	line->dirty = 0;
+    }
+
+    unsigned long missing = mask & ~line->valid;
+    unsigned int i = 0;
+
+    while (missing != 0 && i < MEMCACHE_LINESIZE)
+    {
+	if (!(missing & (1UL << i)))
+	{
+	    i++;
+	    continue;
+	}
+
+	unsigned int start = i;
+	while (i < MEMCACHE_LINESIZE && (missing & (1UL << i)))
+	    i++;
+
+	debugOut("memory cache: fill %d bytes at 0x%lx\n",
+		 i - start, lineAddr + start);
+	jtagRead(lineAddr + start, i - start, line->data + start);
+	line->valid |= lineMask(start, i - start);
+	missing &= ~lineMask(start, i - start);
+    }
+}
+
+void jtag::memoryRead(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    unsigned long space = addr & ADDR_SPACE_MASK;
+
+    if (space == FLASH_SPACE_ADDR_OFFSET && flashShadow != NULL &&
+	addr + numBytes <= flashShadowSize)
+    {
+	memcpy(buf, flashShadow + addr, numBytes);
+	return;
+    }
+
+    if (space != DATA_SPACE_ADDR_OFFSET && space != EEPROM_SPACE_ADDR_OFFSET)
+    {
+	uncachedRead(addr, numBytes, buf);
+	return;
+    }
+
+    while (numBytes > 0)
+    {
+	unsigned long lineAddr = addr & ~(unsigned long)(MEMCACHE_LINESIZE - 1);
+	unsigned int offset = addr - lineAddr;
+	unsigned int count = MEMCACHE_LINESIZE - offset;
+	if (count > numBytes)
+	    count = numBytes;
+	unsigned long mask = lineMask(offset, count);
+	int policy = memCachePolicy(lineAddr);
+
+	if (policy == MEMCACHE_NONE)
+	{
+	    uncachedRead(addr, count, buf);
+	}
+	else
+	{
+	    memcache_line *line = cacheSlot(memCache, lineAddr);
+
+	    if (policy == MEMCACHE_IO)
+	    {
+		if (line->addr != lineAddr || (line->valid & mask) != mask)
+		    memCacheFillBytes(lineAddr, mask);
+	    }
+	    else if (line->addr != lineAddr || (line->valid & mask) != mask)
+	    {
+		// Coalesce with the following lines of this request that
+		// are missing as well.
+		unsigned int maxLines = maxMemoryTransfer() / MEMCACHE_LINESIZE;
+		unsigned int numLines = 1;
+		unsigned long end = addr + numBytes;
+
+		if (maxLines > MEMCACHE_LINES)
+		    maxLines = MEMCACHE_LINES;
+		while (numLines < maxLines)
+		{
+		    unsigned long next = lineAddr + numLines * MEMCACHE_LINESIZE;
+		    memcache_line *nline = cacheSlot(memCache, next);
+
+		    if (next >= end ||
+			(nline->addr == next && nline->valid != 0) ||
+			memCachePolicy(next) != policy)
+			break;
+		    numLines++;
+		}
+		memCacheFill(lineAddr, numLines);
+	    }
+	    memcpy(buf, line->data + offset, count);
+	}
+
+	addr += count;
+	buf += count;
+	numBytes -= count;
+    }
+}
+
+void jtag::memoryWrite(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    unsigned long space = addr & ADDR_SPACE_MASK;
+
+    if (space != DATA_SPACE_ADDR_OFFSET && space != EEPROM_SPACE_ADDR_OFFSET)
+    {
+	if (space == FLASH_SPACE_ADDR_OFFSET)
+	    setFlashShadow(NULL, 0);
+	uncachedWrite(addr, numBytes, buf);
+	return;
+    }
+
+    while (numBytes > 0)
+    {
+	unsigned long lineAddr = addr & ~(unsigned long)(MEMCACHE_LINESIZE - 1);
+	unsigned int offset = addr - lineAddr;
+	unsigned int count = MEMCACHE_LINESIZE - offset;
+	if (count > numBytes)
+	    count = numBytes;
+	unsigned long mask = lineMask(offset, count);
+	memcache_line *line = cacheSlot(memCache, lineAddr);
+
+	switch (memCachePolicy(lineAddr))
+	{
+	case MEMCACHE_NONE:
+	    jtagWrite(addr, count, buf);
+	    break;
+
+	case MEMCACHE_IO:
+	    // the register need not read back what was written
+	    jtagWrite(addr, count, buf);
+	    if (line->addr == lineAddr)
+		line->valid &= ~mask;
+	    break;
+
+	case MEMCACHE_WRITETHROUGH:
+	    jtagWrite(addr, count, buf);
+	    if (line->addr == lineAddr && line->valid != 0)
+	    {
+		memcpy(line->data + offset, buf, count);
+		line->valid |= mask;
+	    }
+	    break;
+
+	case MEMCACHE_WRITEBACK:
+	    if (line->valid != 0 && line->addr != lineAddr)
+	    {
+		memCacheWriteBack(line);
+		line->valid = 0;
+	    }
+	    if (line->valid == 0)
+	    {
+		line->addr = lineAddr;
+		line->dirty = 0;
+	    }
+	    memcpy(line->data + offset, buf, count);
+	    line->valid |= mask;
+	    line->dirty |= mask;
+	    break;
+	}
+
+	addr += count;
+	buf += count;
+	numBytes -= count;
+    }
+}
+
+void jtag::setFlashShadow(uchar *image, unsigned int size)
+{
+    delete [] flashShadow;
+    flashShadow = image;
+    flashShadowSize = image != NULL? size: 0;
+}
+
+void jtag::invalidateCaches(void)
+{
+    invalidateRegisterFile();
+    setFlashShadow(NULL, 0);
+
+    try
+    {
+	for (int i = 0; i < MEMCACHE_LINES; i++)
+	    if (memCache[i].valid != 0)
+		memCacheWriteBack(&memCache[i]);
+    }
+    catch (jtag_exception&)
+    {
+	memset(memCache, 0, sizeof memCache);
+	throw;
+    }
+    memset(memCache, 0, sizeof memCache);
+}
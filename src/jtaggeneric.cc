@@ -62,7 +62,15 @@ void jtag::restoreSerialPort()
 jtag::jtag(void)
 {
   jtagBox = 0;
+  usbLink = NULL;
   softbp_only = is_xmega = oldtioValid = is_usb = false;
+  regFileValid = false;
+  memset(memCache, 0, sizeof memCache);
+  flashShadow = NULL;
+  flashShadowSize = 0;
+  eventQueueHead = eventQueueCount = 0;
+  rxStart = rxEnd = 0;
+  framePoolCount = 0;
 }
 
 jtag::jtag(const char *jtagDeviceName, char *name, emulator type)
@@ -70,7 +78,15 @@ jtag::jtag(const char *jtagDeviceName, char *name, emulator type)
     struct termios newtio;
 
     jtagBox = 0;
+    usbLink = NULL;
     oldtioValid = is_usb = false;
+    regFileValid = false;
+    memset(memCache, 0, sizeof memCache);
+    flashShadow = NULL;
+    flashShadowSize = 0;
+    eventQueueHead = eventQueueCount = 0;
+    rxStart = rxEnd = 0;
+    framePoolCount = 0;
     device_name = name;
     emu_type = type;
     programmingEnabled = 0;
@@ -137,15 +153,91 @@ jtag::jtag(const char *jtagDeviceName, char *name, emulator type)
 jtag::~jtag(void)
 {
   restoreSerialPort();
+  delete [] flashShadow;
+  discardEvents();
+  while (framePoolCount > 0)
+    delete [] framePool[--framePoolCount];
 }
 
+void jtag::queueEvent(uchar *evt)
+{
+    if (eventQueueCount == MAX_QUEUED_EVENTS)
+    {
+	debugOut("event queue full, dropping oldest event\n");
+	freeFrame(dequeueEvent());
+    }
+    eventQueue[(eventQueueHead + eventQueueCount) % MAX_QUEUED_EVENTS] = evt;
+    eventQueueCount++;
+}
 
-int jtag::timeout_read(void *buf, size_t count, unsigned long timeout)
+uchar *jtag::dequeueEvent(void)
 {
-    char *buffer = (char *)buf;
-    size_t actual = 0;
+    if (eventQueueCount == 0)
+	return NULL;
 
-    while (actual < count)
+    uchar *evt = eventQueue[eventQueueHead];
+    eventQueueHead = (eventQueueHead + 1) % MAX_QUEUED_EVENTS;
+    eventQueueCount--;
+
+    return evt;
+}
+
+void jtag::discardEvents(bool (*stale)(const uchar *evt))
+{
+    // Rotate through the queue once, keeping what is still of interest
+    for (int n = eventQueueCount; n > 0; n--)
+    {
+	uchar *evt = dequeueEvent();
+
+	if (stale == NULL || stale(evt))
+	    freeFrame(evt);
+	else
+	    queueEvent(evt);
+    }
+}
+
+uchar *jtag::allocFrame(unsigned int size)
+{
+    if (size > FRAME_POOL_BUFSIZE)
+	return new uchar[size];
+    if (framePoolCount > 0)
+	return framePool[--framePoolCount];
+
+    return new uchar[FRAME_POOL_BUFSIZE];
+}
+
+void jtag::freeFrame(uchar *frame)
+{
+    // Every frame from allocFrame() is at least FRAME_POOL_BUFSIZE large
+    if (frame != NULL && framePoolCount < FRAME_POOL_SIZE)
+	framePool[framePoolCount++] = frame;
+    else
+	delete [] frame;
+}
+
+void jtag::jtagRead(unsigned long addr, unsigned int numBytes, uchar *buf)
+{
+    uchar *data = jtagRead(addr, numBytes);
+
+    if (data == NULL)
+	throw jtag_exception("Failed to read target memory");
+    memcpy(buf, data, numBytes);
+    delete [] data;
+}
+
+int jtag::fillReceiveBuffer(unsigned long timeout)
+{
+    // Keep the buffered data at the start of the buffer
+    if (rxStart == rxEnd)
+	rxStart = rxEnd = 0;
+    else if (rxStart > 0)
+    {
+	memmove(rxBuffer, rxBuffer + rxStart, rxEnd - rxStart);
+	rxEnd -= rxStart;
+	rxStart = 0;
+    }
+
+    for (;;)
     {
 	fd_set readfds;
 	FD_ZERO(&readfds);
@@ -164,15 +256,48 @@ int jtag::timeout_read(void *buf, size_t count, unsigned long timeout)
             continue;
 
 	if (selected == 0)
-	    return actual;
+	    return 0;
 
-	ssize_t thisread = read(jtagBox, &buffer[actual], count - actual);
-        if ((thisread < 0) && (errno == EAGAIN))
+	ssize_t thisread = read(jtagBox, rxBuffer + rxEnd,
+				RX_BUFFER_SIZE - rxEnd);
+        if ((thisread < 0) && (errno == EAGAIN || errno == EINTR))
             continue;
 	if (thisread < 0)
             throw jtag_exception();
+	if (thisread == 0)
+	    // EOF, treated like a timeout
+	    return 0;
+
+	rxEnd += thisread;
+	return thisread;
+    }
+}
+
+bool jtag::receiveBytes(unsigned int count, unsigned long timeout)
+{
+    while (rxEnd - rxStart < count)
+	if (fillReceiveBuffer(timeout) == 0)
+	    return false;
+
+    return true;
+}
 
-	actual += thisread;
+int jtag::timeout_read(void *buf, size_t count, unsigned long timeout)
+{
+    char *buffer = (char *)buf;
+    size_t actual = 0;
+
+    while (actual < count)
+    {
+	if (rxStart == rxEnd && fillReceiveBuffer(timeout) == 0)
+	    return actual;
+
+	size_t chunk = rxEnd - rxStart;
+	if (chunk > count - actual)
+	    chunk = count - actual;
+	memcpy(buffer + actual, rxBuffer + rxStart, chunk);
+	rxStart += chunk;
+	actual += chunk;
     }
 
     return count;
@@ -182,15 +307,23 @@ int jtag::safewrite(const void *b, int count)
 {
   char *buffer = (char *)b;
   int actual = 0;
-  int flags = fcntl(jtagBox, F_GETFL);
 
-  fcntl(jtagBox, F_SETFL, 0); // blocking mode
+  // Normally a single write(); the descriptor is non-blocking though, so
+  // wait for room if the ICE link is backed up.
   while (count > 0)
     {
       int n = write(jtagBox, buffer, count);
 
       if (n == -1 && errno == EINTR)
 	continue;
+      if (n == -1 && errno == EAGAIN)
+	{
+	  fd_set writefds;
+	  FD_ZERO(&writefds);
+	  FD_SET(jtagBox, &writefds);
+	  select(jtagBox + 1, NULL, &writefds, NULL, NULL);
+	  continue;
+	}
       if (n == -1)
 	{
 	  actual = -1;
@@ -201,7 +334,6 @@ int jtag::safewrite(const void *b, int count)
       actual += n;
       buffer += n;
     }
-  fcntl(jtagBox, F_SETFL, flags); 
   return actual;
 }
 
@@ -246,12 +378,12 @@ void jtag::changeLocalBitRate(int newBitRate)
     cfsetispeed(&tio, newPortSpeed);
 
     if (tcsetattr(jtagBox,TCSANOW,&tio) < 0 ||
-        tcflush(jtagBox, TCIFLUSH) < 0)
+        flushInput() < 0)
         throw jtag_exception();
 }
 
 static bool pageIsEmpty(BFDimage *image, unsigned int addr, unsigned int size,
-                        BFDmemoryType memtype)
+                        BFDmemoryType memtype, bool incremental)
 {
     bool emptyPage = true;
 
@@ -263,10 +395,11 @@ static bool pageIsEmpty(BFDimage *image, unsigned int addr, unsigned int size,
 
         // 1. If this address existed in input file, mark as ! empty.
         // 2. If we are programming FLASH, and contents == 0xff, we need
-        //    not program (is 0xff after erase).
+        //    not program (is 0xff after erase).  This does not hold
+        //    for incremental programming, where nothing is erased.
         if (image->image[idx].used)
         {
-            if (!((memtype == MEM_FLASH) &&
+            if (!((memtype == MEM_FLASH) && !incremental &&
                   (image->image[idx].val == 0xff)))
             {
                 emptyPage = false;
@@ -296,14 +429,74 @@ unsigned int jtag::get_page_size(BFDmemoryType memtype)
 }
 
 
+void jtag::jtagWritePages(unsigned long addr, unsigned int pageSize,
+			  unsigned int numPages, uchar buffer[])
+{
+    for (unsigned int i = 0; i < numPages; i++)
+	jtagWrite(addr + i * pageSize, pageSize, buffer + i * pageSize);
+}
+
+/** Bring the flash or EEPROM page at 'addr' (including the memory
+    space offset) up to date with 'page'.  The page is read back first,
+    and only written if its contents differ.  Flash pages are erased
+    before if any bit has to change from 0 to 1; if the device cannot
+    erase single pages, nothing is written, and PAGE_NEEDS_CHIP_ERASE
+    is returned.  Bytes for which 'used' is false are don't-care, they
+    keep their current contents; 'used' may be NULL.
+**/
+jtag::pageUpdate jtag::updatePage(unsigned long addr, unsigned int size,
+				  uchar *page, const bool *used)
+{
+    uchar *current = jtagRead(addr, size);
+    bool differs = false;
+    bool needErase = false;
+
+    for (unsigned int i = 0; i < size; i++)
+    {
+	if (used != NULL && !used[i])
+	    page[i] = current[i];
+	else if (page[i] != current[i])
+	{
+	    differs = true;
+	    if (page[i] & ~current[i])
+		needErase = true;
+	}
+    }
+    delete [] current;
+
+    if (!differs)
+    {
+	debugOut("Page at 0x%lx unchanged\n", addr);
+	return PAGE_UNCHANGED;
+    }
+
+    if (needErase && addr < DATA_SPACE_ADDR_OFFSET)
+    {
+	if (!pageEraseSupported())
+	{
+	    debugOut("Page at 0x%lx needs a chip erase\n", addr);
+	    return PAGE_NEEDS_CHIP_ERASE;
+	}
+	debugOut("Erasing page at 0x%lx\n", addr);
+	eraseProgramPage(addr);
+    }
+    jtagWrite(addr, size, page);
+
+    return PAGE_WRITTEN;
+}
+
 void jtag::jtag_flash_image(BFDimage *image, BFDmemoryType memtype,
                              bool program, bool verify)
 {
     unsigned int page_size = get_page_size(memtype);
     static uchar buf[MAX_IMAGE_SIZE];
+    static bool used[MAX_IMAGE_SIZE];
     unsigned int i;
     uchar *response = NULL;
     unsigned int addr;
+    unsigned int pages = 0, written = 0;
+    unsigned int runAddr = 0, runPages = 0;
+    bool incremental = incrementalProgramming;
 
     if (! image->has_data)
     {
@@ -322,36 +515,91 @@ void jtag::jtag_flash_image(BFDimage *image, BFDmemoryType memtype,
 
         while (addr < image->last_address)
         {
-            if (!pageIsEmpty(image, addr, page_size, memtype))
+            bool empty = pageIsEmpty(image, addr, page_size, memtype,
+                                     incremental);
+
+            if (!empty)
             {
                 // Must also convert address to gcc-hacked addr for jtagWrite
                 debugOut("Writing page at addr 0x%.4lx size 0x%lx\n",
                          addr, page_size);
 
-                // Create raw data buffer
-                for (i=0; i<page_size; i++)
-                    buf[i] = image->image[i+addr].val;
+                pages++;
+                if (!incremental)
+                {
+                    // Collect runs of consecutive pages for jtagWritePages
+                    if (runPages == 0)
+                        runAddr = addr;
+                    for (i=0; i<page_size; i++)
+                        buf[runPages * page_size + i] =
+                            image->image[i+addr].val;
+                    runPages++;
+                }
+                else
+                {
+                    // Create raw data buffer
+                    for (i=0; i<page_size; i++)
+                    {
+                        buf[i] = image->image[i+addr].val;
+                        used[i] = image->image[i+addr].used;
+                    }
+
+                    pageUpdate result = PAGE_UNCHANGED;
+
+                    try
+                    {
+                        result = updatePage(BFDmemorySpaceOffset[memtype] + addr,
+                                            page_size, buf, used);
+                    }
+                    catch (jtag_exception& e)
+                    {
+                        fprintf(stderr, "Error writing to target: %s\n",
+                                e.what());
+                    }
+                    if (result == PAGE_WRITTEN)
+                        written++;
+                    else if (result == PAGE_NEEDS_CHIP_ERASE)
+                    {
+                        // No page erase on this device: erase the chip,
+                        // and program the whole image after all
+                        statusOut("\nPage at 0x%.4x needs erasing, erasing "
+                                  "the chip and reprogramming.", addr);
+                        statusFlush();
+                        eraseProgramMemory();
+                        incremental = false;
+                        addr = page_addr(image->first_address, memtype);
+                        pages = 0;
+                        continue;
+                    }
+                }
+            }
+
+            addr += page_size;
 
+            if (runPages > 0 &&
+                (empty || runPages == MAX_PAGES_PER_WRITE ||
+                 addr >= image->last_address))
+            {
                 try
                 {
-                    jtagWrite(BFDmemorySpaceOffset[memtype] + addr,
-                              page_size,
-                              buf);
+                    jtagWritePages(BFDmemorySpaceOffset[memtype] + runAddr,
+                                   page_size, runPages, buf);
                 }
                 catch (jtag_exception& e)
                 {
                     fprintf(stderr, "Error writing to target: %s\n",
                             e.what());
                 }
+                runPages = 0;
             }
 
-            addr += page_size;
-
             statusOut(".");
             statusFlush();
         }
 
         statusOut("\n");
+        if (incremental)
+            statusOut("%u of %u pages changed.\n", written, pages);
         statusFlush();
     }
 
@@ -390,13 +638,13 @@ void jtag::jtag_flash_image(BFDimage *image, BFDmemoryType memtype,
                     }
                 }
             }
+            delete [] response;
 
             addr += page_size;
 
             statusOut(".");
             statusFlush();
         }
-        delete [] response;
 
         statusOut("\n");
         statusFlush();
@@ -658,6 +906,71 @@ void jtag::jtagDisplayLockBits(uchar *lockBits)
     statusOut("    Bit 0 [ LB1      ] -> %d\n", (lockBits[0] >> 0) & 1);
 }
 
+bool jtag::readRegisterFile(uchar *regs)
+{
+    if (!regFileValid)
+    {
+	uchar buf[3];
+	unsigned long pc;
+
+	// R0..R31 are at locations 0..31
+	memoryRead(cpuRegisterAreaAddress(), 0x20, regFile);
+
+	// Read in SPL SPH SREG.  This cannot be merged with the read
+	// above, the I/O registers in between might have read side
+	// effects.
+	memoryRead(statusAreaAddress(), 0x03, buf);
+	regFile[REGFILE_SREG] = buf[2];
+	regFile[REGFILE_SP] = buf[0];
+	regFile[REGFILE_SP + 1] = buf[1];
+
+	pc = getProgramCounter();
+	debugOut("PC = %lx\n", pc);
+	if (pc == PC_INVALID)
+	    return false;
+	regFile[REGFILE_PC] = pc & 0xff;
+	regFile[REGFILE_PC + 1] = (pc >> 8) & 0xff;
+	regFile[REGFILE_PC + 2] = (pc >> 16) & 0xff;
+	regFile[REGFILE_PC + 3] = (pc >> 24) & 0xff;
+
+	regFileValid = true;
+    }
+    else
+	debugOut("register file cached\n");
+
+    memcpy(regs, regFile, REGFILE_SIZE);
+    return true;
+}
+
+void jtag::writeRegisterFile(unsigned int regOffset, unsigned int numBytes,
+			     uchar *regs)
+{
+    if (regOffset + numBytes <= REGFILE_SREG)
+	memoryWrite(cpuRegisterAreaAddress() + regOffset, numBytes, regs);
+    else if (regOffset == REGFILE_SREG && numBytes == 1)
+	memoryWrite(statusAreaAddress() + 2, 1, regs);
+    else if (regOffset == REGFILE_SP && numBytes == 2)
+	memoryWrite(statusAreaAddress(), 2, regs);
+    else if (regOffset == REGFILE_PC && numBytes == 4)
+	setProgramCounter(regs[0] | regs[1] << 8 |
+			  regs[2] << 16 | regs[3] << 24);
+    else
+	throw jtag_exception("Invalid register file write");
+
+    if (regFileValid)
+	memcpy(regFile + regOffset, regs, numBytes);
+}
+
+void jtag::registerFileWrite(unsigned long addr, unsigned int numBytes)
+{
+    unsigned long regs = cpuRegisterAreaAddress();
+    unsigned long status = statusAreaAddress();
+
+    if ((addr < regs + 0x20 && addr + numBytes > regs) ||
+	(addr < status + 0x03 && addr + numBytes > status))
+	invalidateRegisterFile();
+}
+
 bool jtag::addBreakpoint(unsigned int address, bpType type, unsigned int length)
 {
     int bp_i;
@@ -60,7 +60,7 @@ SendResult jtag1::sendJtagCommand(uchar *command, int commandSize, int *tries)
     debugOut("\n");
 
     // before writing, clean up any "unfinished business".
-    if (tcflush(jtagBox, TCIFLUSH) < 0)
+    if (flushInput() < 0)
         throw jtag_exception();
 
     int count = safewrite(command, commandSize);
@@ -286,7 +286,7 @@ bool jtag1::synchroniseAt(int bitrate)
 	// 'E  ' is enough, but not always...)
 	sendJtagCommand((uchar *)"SE  ", 4, &tries);
 	usleep(2 * JTAG_COMM_TIMEOUT); // let rest of response come before we ignore it
-	if (tcflush(jtagBox, TCIFLUSH) < 0)
+	if (flushInput() < 0)
             throw jtag_exception();
 	if (checkForEmulator())
 	    return true;
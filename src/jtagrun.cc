@@ -81,6 +81,7 @@ void jtag1::setProgramCounter(unsigned long pc)
 
 void jtag1::resetProgram(bool possible_nSRST)
 {
+  invalidateCaches();
   if (possible_nSRST && apply_nSRST) {
     setJtagParameter(JTAG_P_EXTERNAL_RESET, 0x01);
   }
@@ -99,11 +100,13 @@ void jtag1::interruptProgram(void)
 
 void jtag1::resumeProgram(void)
 {
+    invalidateCaches();
     doSimpleJtagCommand('G', 0);
 }
 
 void jtag1::jtagSingleStep(void)
 {
+    invalidateCaches();
     doSimpleJtagCommand('1', 1);
 }
 
@@ -116,6 +119,7 @@ bool jtag1::jtagContinue(void)
 {
     updateBreakpoints();        // download new bp configuration
 
+    invalidateCaches();
     if (!doSimpleJtagCommand('G', 0))
     {
 	gdbOut("Failed to continue\n");
@@ -139,14 +143,19 @@ bool jtag1::jtagContinue(void)
 	FD_SET (jtagBox, &readfds);
 	maxfd = jtagBox > gdbFileDescriptor ? jtagBox : gdbFileDescriptor;
 
-	int numfds = select(maxfd + 1, &readfds, 0, 0, 0);
+	// Don't block if gdb or ICE input is already waiting in our buffers.
+	bool gdbPending = gdbInputPending();
+	struct timeval notime = { 0, 0 };
+
+	int numfds = select(maxfd + 1, &readfds, 0, 0,
+			    gdbPending || receivePending()? &notime: 0);
 	if (numfds < 0)
         {
             fprintf(stderr, "GDB/JTAG ICE communications failure");
             throw jtag_exception();
         }
 
-	if (FD_ISSET(gdbFileDescriptor, &readfds))
+	if (gdbPending || FD_ISSET(gdbFileDescriptor, &readfds))
 	{
 	    int c = getDebugChar();
 	    if (c == 3) // interrupt
@@ -39,6 +39,9 @@
 #include <unistd.h>
 #include <netinet/tcp.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "avarice.h"
 #include "remote.h"
@@ -46,9 +49,11 @@
 #include "jtag1.h"
 #include "jtag2.h"
 #include "jtag3.h"
+#include "profile.h"
 #include "gnu_getopt.h"
 
 bool ignoreInterrupts;
+bool incrementalProgramming;
 
 static int makeSocket(struct sockaddr_in *name)
 {
@@ -92,6 +97,46 @@ static int makeSocket(struct sockaddr_in *name)
     return sock;
 }
 
+/** Remove the Unix domain socket at exit **/
+static const char *unixSocketPath;
+
+static void removeUnixSocket(void)
+{
+    unlink(unixSocketPath);
+}
+
+static int makeUnixSocket(const char *path)
+{
+    struct sockaddr_un name;
+    struct stat st;
+    int sock;
+
+    if (strlen(path) >= sizeof(name.sun_path))
+        throw jtag_exception("Unix domain socket path too long");
+
+    memset(&name, 0, sizeof(name));
+    name.sun_family = AF_UNIX;
+    strcpy(name.sun_path, path);
+
+    sock = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        throw jtag_exception();
+
+    // A socket left behind by an earlier run would make bind() fail
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&name, sizeof(name)) < 0)
+    {
+        fprintf(stderr, "bind() failed: %s: %s\n", path, strerror(errno));
+        throw jtag_exception("bind() failed");
+    }
+
+    unixSocketPath = path;
+    atexit(removeUnixSocket);
+
+    return sock;
+}
 
 static void initSocketAddress(struct sockaddr_in *name,
 			      const char *hostname, unsigned short int port)
@@ -163,6 +208,10 @@ static void usage(const char *progname)
 	    "  -3, --jtag3                 Connect to JTAGICE3 (Firmware 2.x)\n");
     fprintf(stderr,
             "  -4, --edbg                  Atmel-ICE, or JTAGICE3 (firmware 3.x), or EDBG Integrated Debugger\n");
+    fprintf(stderr,
+	    "  -b, --broker                Accept several gdb/tool connections at once;\n"
+	    "                                the first one controls the target, the\n"
+	    "                                others may only inspect it.\n");
     fprintf(stderr,
             "  -B, --jtag-bitrate <rate>   Set the bitrate that the JTAG box communicates\n"
             "                                with the avr target device. This must be less\n"
@@ -201,6 +250,11 @@ static void usage(const char *progname)
 	    "                                This implies --mkII, but might be required in\n"
 	    "                                addition to --debugwire when debugWire is to\n"
 	    "                                be used.\n");
+    fprintf(stderr,
+	    "  -i, --incremental           Only reprogram pages whose contents differ\n"
+	    "                                from the target.  Without page erase\n"
+	    "                                (megaAVR JTAG), a page needing an erase\n"
+	    "                                makes it erase the chip and program all.\n");
     fprintf(stderr,
 	    "  -I, --ignore-intr           Automatically step over interrupts.\n"
 	    "                                Note: EXPERIMENTAL. Can not currently handle\n"
@@ -209,6 +263,10 @@ static void usage(const char *progname)
 	    "  -j, --jtag <devname>        Port attached to JTAG box (default: /dev/avrjtag).\n");
     fprintf(stderr,
 	    "  -k, --known-devices         Print a list of known devices.\n");
+    fprintf(stderr,
+	    "  -K, --persistent            Keep the ICE session open when gdb\n"
+	    "                                disconnects, and wait for the next\n"
+	    "                                connection.\n");
     fprintf(stderr,
             "  -L, --write-lockbits <ll>   Write lock bits.\n");
     fprintf(stderr,
@@ -226,6 +284,20 @@ static void usage(const char *progname)
             "  -r, --read-fuses            Read fuses bytes.\n");
     fprintf(stderr,
             "  -R, --reset-srst            External reset through nSRST signal.\n");
+    fprintf(stderr,
+            "  -S, --profile <secs>[,<rate>]\n"
+            "                                Sample the PC of the running target for\n"
+            "                                <secs> seconds (default: 100 samples/s),\n"
+            "                                symbolized with --file.  Writes\n"
+            "                                " PROFILE_DEFAULT_PREFIX ".flat and\n"
+            "                                " PROFILE_DEFAULT_PREFIX ".folded.  Not in gdb\n"
+            "                                server mode.\n");
+    fprintf(stderr,
+	    "  -s, --stdio                 Talk to gdb over stdin/stdout, for\n"
+	    "                                gdb's \"target remote | avarice --stdio ...\"\n");
+    fprintf(stderr,
+	    "  -U, --unix <path>           Wait for gdb on the Unix domain socket <path>\n"
+	    "                                rather than on a TCP port.\n");
     fprintf(stderr,
 	    "  -V, --version               Print version information.\n");
 #if ENABLE_TARGET_PROGRAMMING
@@ -244,7 +316,8 @@ static void usage(const char *progname)
             "  -X, --pdi                   AVR part is an ATxmega device, using PDI.\n");
     fprintf(stderr,
 	    "HOST_NAME defaults to 0.0.0.0 (listen on any interface).\n"
-	    "\":PORT\" is required to put avarice into gdb server mode.\n\n");
+	    "\":PORT\", --stdio or --unix is required to put avarice into gdb server\n"
+	    "mode.\n\n");
     fprintf(stderr,
             "Example usage:\n");
     fprintf(stderr,
@@ -313,6 +386,7 @@ static struct option long_opts[] = {
     { "mkII",                0,       0,     '2' },
     { "jtag3",               0,       0,     '3' },
     { "edbg",                0,       0,     '4' },
+    { "broker",              0,       0,     'b' },
     { "jtag-bitrate",        1,       0,     'B' },
     { "capture",             0,       0,     'C' },
     { "daisy-chain",         1,       0,     'c' },
@@ -324,7 +398,9 @@ static struct option long_opts[] = {
     { "dragon",              0,       0,     'g' },
     { "help",                0,       0,     'h' },
     { "ignore-intr",         0,       0,     'I' },
+    { "incremental",         0,       0,     'i' },
     { "jtag",                1,       0,     'j' },
+    { "persistent",          0,       0,     'K' },
     { "known-devices",       0,       0,     'k' },
     { "write-lockbits",      1,       0,     'L' },
     { "read-lockbits",       0,       0,     'l' },
@@ -332,6 +408,9 @@ static struct option long_opts[] = {
     { "program",             0,       0,     'p' },
     { "reset-srst",          0,       0,     'R' },
     { "read-fuses",          0,       0,     'r' },
+    { "profile",             1,       0,     'S' },
+    { "stdio",               0,       0,     's' },
+    { "unix",                1,       0,     'U' },
     { "version",             0,       0,     'V' },
     { "verify",              0,       0,     'v' },
     { "debugwire",           0,       0,     'w' },
@@ -346,7 +425,6 @@ jtag *theJtagICE;
 int main(int argc, char **argv)
 {
     int sock;
-    struct sockaddr_in clientname;
     struct sockaddr_in name;
     char *inFileName = 0;
     const char *jtagDeviceName = NULL;
@@ -365,10 +443,16 @@ int main(int argc, char **argv)
     bool gdbServerMode = false;
     char *lockBits = NULL;
     bool detach = false;
+    bool broker = false;
+    bool persistent = false;
+    bool useStdio = false;
+    const char *unixPath = NULL;
     bool capture = false;
     bool verify = false;
     bool apply_nsrst = false;
     bool is_xmega = false;
+    double profileSeconds = 0;
+    unsigned int profileRate = PROFILE_DEFAULT_RATE;
     char *progname = argv[0];
     enum {
 	MKI, MKII, DRAGON, JTAG3, EDBG
@@ -389,7 +473,7 @@ int main(int argc, char **argv)
 
     while (1)
     {
-        int c = getopt_long (argc, argv, "1234B:Cc:DdeE:f:ghIj:kL:lP:pRrVvwW:xX",
+        int c = getopt_long (argc, argv, "1234bB:Cc:DdeE:f:ghIij:KkL:lP:pRrS:sU:VvwW:xX",
                              long_opts, &option_index);
         if (c == -1)
             break;              /* no more options */
@@ -412,6 +496,12 @@ int main(int argc, char **argv)
             case '4':
                 devicetype = EDBG;
                 break;
+            case 'b':
+                broker = true;
+                break;
+            case 'K':
+                persistent = true;
+                break;
             case 'B':
 		jtagBitrate = parseJtagBitrate(optarg);
                 break;
@@ -453,6 +543,9 @@ int main(int argc, char **argv)
             case 'I':
                 ignoreInterrupts = true;
                 break;
+            case 'i':
+                incrementalProgramming = true;
+                break;
             case 'j':
                 jtagDeviceName = optarg;
                 break;
@@ -475,6 +568,17 @@ int main(int argc, char **argv)
             case 'r':
                 readFuses = true;
                 break;
+            case 's':
+                useStdio = true;
+                break;
+            case 'U':
+                unixPath = optarg;
+                break;
+            case 'S':
+                if (sscanf(optarg, "%lf,%u", &profileSeconds, &profileRate) < 1 ||
+                    profileSeconds <= 0 || profileRate == 0)
+                    usage(progname);
+                break;
             case 'V':
                 exit(0);
             case 'v':
@@ -556,6 +660,35 @@ int main(int argc, char **argv)
         usage (progname);
     }
 
+    if (useStdio || unixPath != NULL)
+    {
+        if (gdbServerMode || (useStdio && unixPath != NULL))
+        {
+            fprintf(stderr, "avarice: only one of [HOST_NAME]:PORT, --stdio, "
+                    "and --unix can be used\n");
+            exit(1);
+        }
+        if (useStdio && (broker || persistent || detach))
+        {
+            fprintf(stderr, "avarice: --stdio serves a single gdb, it cannot "
+                    "be combined with --broker, --persistent or --detach\n");
+            exit(1);
+        }
+        gdbServerMode = true;
+    }
+
+    int gdbOutput = -1;
+    if (useStdio)
+    {
+        // stdout belongs to gdb now, everything else goes to stderr
+        gdbOutput = dup(1);
+        if (gdbOutput < 0 || dup2(2, 1) < 0)
+        {
+            perror("avarice: dup");
+            exit(1);
+        }
+    }
+
     if (jtagBitrate == 0 && (proto == PROTO_JTAG))
     {
         fprintf (stdout,
@@ -669,7 +802,8 @@ int main(int argc, char **argv)
                 program = true;
             }
 
-            if ((erase == false) && (program == true)) {
+            if ((erase == false) && (program == true) &&
+                !incrementalProgramming) {
                 statusOut("WARNING: The default behaviour has changed.\n"
                           "Programming no longer erases by default. If you want to"
                           " erase and program\nin a single step, use the --erase "
@@ -713,13 +847,47 @@ int main(int argc, char **argv)
 
         // Quit & resume mote for operations that don't interact with gdb.
         if (!gdbServerMode)
-            theJtagICE->resumeProgram();
+        {
+            if (profileSeconds > 0)
+            {
+                char summary[1024];
+
+                profileTarget(profileSeconds, profileRate, inFileName,
+                              PROFILE_DEFAULT_PREFIX, false,
+                              summary, sizeof summary);
+                statusOut("%s", summary);
+            }
+            else
+                theJtagICE->resumeProgram();
+        }
+        else if (useStdio)
+        {
+            setGdbFile(0, gdbOutput);
+            try
+            {
+                for (;;)
+                    talkToGdb();
+            }
+            catch (jtag_exception&)
+            {
+                if (!gdbExited)
+                    throw;
+            }
+        }
         else
         {
-            initSocketAddress(&name, hostName, hostPortNumber);
-            sock = makeSocket(&name);
-            statusOut("Waiting for connection on port %hu.\n", hostPortNumber);
-            if (listen(sock, 1) < 0)
+            if (unixPath != NULL)
+            {
+                sock = makeUnixSocket(unixPath);
+                statusOut("Waiting for connection on %s.\n", unixPath);
+            }
+            else
+            {
+                initSocketAddress(&name, hostName, hostPortNumber);
+                sock = makeSocket(&name);
+                statusOut("Waiting for connection on port %hu.\n", hostPortNumber);
+            }
+            if (listen(sock, broker? 5: 1) < 0)
                 throw jtag_exception();
 
             if (detach)
@@ -741,21 +909,53 @@ int main(int argc, char **argv)
                     }
             }
 
-            // Connection request on original socket.
-            socklen_t size = (socklen_t)sizeof(clientname);
-            int gfd = accept(sock, (struct sockaddr *)&clientname, &size);
-            if (gfd < 0)
-                throw jtag_exception();
-            statusOut("Connection opened by host %s, port %hu.\n",
-                      inet_ntoa(clientname.sin_addr), ntohs(clientname.sin_port));
-
-            setGdbFile(gfd);
+            // A gdb vanishing in the middle of a reply must not take
+            // the server down when it is meant to outlive it
+            if (broker || persistent)
+                signal(SIGPIPE, SIG_IGN);
 
-            // Now do the actual processing of GDB messages
-            // We stay here until exiting because of error of EOF on the
-            // gdb connection
             for (;;)
-                talkToGdb();
+            {
+                if (broker)
+                {
+                    // Serve all clients until the last one disconnects
+                    serveGdbClients(sock);
+                }
+                else
+                {
+                    // Connection request on original socket.
+                    int gfd = acceptGdbConnection(sock);
+                    if (gfd < 0)
+                        throw jtag_exception();
+
+                    setGdbFile(gfd);
+
+                    // Now do the actual processing of GDB messages
+                    // We stay here until exiting because of error of EOF on the
+                    // gdb connection
+                    try
+                    {
+                        for (;;)
+                            talkToGdb();
+                    }
+                    catch (jtag_exception&)
+                    {
+                        if (!persistent || !gdbExited)
+                            throw;
+                    }
+                    close(gfd);
+                }
+
+                if (!persistent)
+                    break;
+
+                // Keep the ICE session, the next gdb can start right away
+                gdbExited = false;
+                if (unixPath != NULL)
+                    statusOut("Waiting for connection on %s.\n", unixPath);
+                else
+                    statusOut("Waiting for connection on port %hu.\n", hostPortNumber);
+            }
         }
     }
     catch (const char *msg)
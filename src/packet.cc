@@ -0,0 +1,196 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file implements the encoding and decoding of GDB remote
+ * protocol packet data.  Hex conversion is table driven, two digits
+ * at a time.  Replies are run-length encoded before they are sent,
+ * which shrinks hex dumps of erased flash (all 'f') and cleared SRAM
+ * (all '0') a lot.
+ *
+ * $Id$
+ */
+
+#include <string.h>
+
+#include "avarice.h"
+#include "packet.h"
+
+// "000102...feff": the two hex digits of each byte value
+#define HEX16(h) \
+    h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+    h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+
+static const char hexPairs[] =
+    HEX16("0") HEX16("1") HEX16("2") HEX16("3")
+    HEX16("4") HEX16("5") HEX16("6") HEX16("7")
+    HEX16("8") HEX16("9") HEX16("a") HEX16("b")
+    HEX16("c") HEX16("d") HEX16("e") HEX16("f");
+
+#undef HEX16
+
+// Value of each hex digit, -1 for everything else
+static const signed char hexValues[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+enum {
+    // A run is sent as the character, '*', and the number of
+    // repetitions + 29, which has to be printable and must not be
+    // '#' or '$'.
+    RLE_OFFSET		= 29,
+    RLE_MIN_REPEAT	= 3,		// shorter runs don't get shorter
+    RLE_MAX_REPEAT	= 126 - RLE_OFFSET,
+};
+
+char *byteToHex(uchar x, char *buf)
+{
+    memcpy(buf, &hexPairs[2 * x], 2);
+
+    return buf + 2;
+}
+
+int hex(unsigned char ch)
+{
+    return hexValues[ch];
+}
+
+int hexToInt(char **ptr, int *intValue, int nMax)
+{
+    int numChars = 0;
+    int hexValue;
+
+    *intValue = 0;
+    while ((hexValue = hexValues[(uchar)**ptr]) >= 0)
+    {
+	*intValue = (*intValue << 4) | hexValue;
+	numChars++;
+	(*ptr)++;
+        if (nMax != 0 && numChars >= nMax)
+            break;
+    }
+    return (numChars);
+}
+
+char *mem2hex(const uchar *mem, char *buf, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+	memcpy(buf, &hexPairs[2 * mem[i]], 2);
+	buf += 2;
+    }
+    *buf = 0;
+
+    return (buf);
+}
+
+uchar *hex2mem(const char *buf, uchar *mem, int count)
+{
+    const uchar *in = (const uchar *)buf;
+
+    for (int i = 0; i < count; i++)
+    {
+	*mem++ = (hexValues[in[0]] << 4) | (hexValues[in[1]] & 0xf);
+	in += 2;
+    }
+
+    return (mem);
+}
+
+char *mem2bin(const uchar *mem, char *buf, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+	uchar c = *mem++;
+
+	if (c == '#' || c == '$' || c == '}' || c == '*' || c == '\0')
+	{
+	    *buf++ = '}';
+	    c ^= 0x20;
+	}
+	*buf++ = c;
+    }
+    *buf = 0;
+
+    return (buf);
+}
+
+uchar packetChecksum(const char *data, int length)
+{
+    const uchar *p = (const uchar *)data;
+    unsigned int sum = 0;
+
+    for (int i = 0; i < length; i++)
+	sum += p[i];
+
+    return (uchar)sum;
+}
+
+int packetCompress(const char *data, char *buf)
+{
+    char *out = buf;
+
+    while (*data)
+    {
+	char c = *data;
+
+	// gdb repeats the raw preceding character, so never start a
+	// run on the second half of an escape sequence.
+	if (c == '}' && data[1] != '\0')
+	{
+	    *out++ = *data++;
+	    *out++ = *data++;
+	    continue;
+	}
+
+	int run = 1;
+	while (data[run] == c && run <= RLE_MAX_REPEAT)
+	    run++;
+
+	int repeat = run - 1;
+	if (repeat < RLE_MIN_REPEAT || c == '*' || c == '#' || c == '$')
+	{
+	    memcpy(out, data, run);
+	    out += run;
+	    data += run;
+	    continue;
+	}
+
+	// 6 and 7 would be encoded as '#' and '$'
+	if (repeat + RLE_OFFSET == '#' || repeat + RLE_OFFSET == '$')
+	    repeat = '"' - RLE_OFFSET;
+	*out++ = c;
+	*out++ = '*';
+	*out++ = repeat + RLE_OFFSET;
+	data += repeat + 1;
+    }
+
+    return out - buf;
+}
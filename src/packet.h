@@ -0,0 +1,70 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file declares the encoding and decoding of GDB remote protocol
+ * packet data.
+ *
+ * $Id$
+ */
+
+#ifndef INCLUDE_PACKET_H
+#define INCLUDE_PACKET_H
+
+#include "avarice.h"
+
+/** Write 'x' as two hex digits to 'buf'. Return a pointer past them. **/
+char *byteToHex(uchar x, char *buf);
+
+/** Return the value of hex digit 'ch', or -1 **/
+int hex(unsigned char ch);
+
+/** Convert hex string at '*ptr' to an integer.
+    Advances '*ptr' to 1st non-hex character found, or after 'nMax'
+    characters if that is not 0.
+    Returns number of characters used in conversion.
+ **/
+int hexToInt(char **ptr, int *intValue, int nMax = 0);
+
+/** Convert the memory pointed to by mem into hex, placing result in buf.
+    Return a pointer to the last char put in buf (null).
+**/
+char *mem2hex(const uchar *mem, char *buf, int count);
+
+/** Convert the hex array pointed to by buf into binary to be placed in mem.
+    Return a pointer to the character AFTER the last byte written.
+**/
+uchar *hex2mem(const char *buf, uchar *mem, int count);
+
+/** Convert 'count' bytes of memory pointed to by 'mem' into binary
+    packet data in buf, escaping all characters that are special to the
+    remote protocol.  NUL is escaped as well, so the result is still a
+    proper C string.
+    Return a pointer to the last char put in buf (null).
+**/
+char *mem2bin(const uchar *mem, char *buf, int count);
+
+/** Return the checksum of 'length' bytes of packet data at 'data' **/
+uchar packetChecksum(const char *data, int length);
+
+/** Copy the packet data 'data' (a C string) to 'buf', replacing runs
+    of the same character by run-length encoding ("c*n", see "Overview"
+    in the remote protocol chapter of the gdb manual).  The result is
+    never longer than 'data'.  Return its length; 'buf' is not NUL
+    terminated.
+**/
+int packetCompress(const char *data, char *buf);
+
+#endif /* INCLUDE_PACKET_H */
@@ -0,0 +1,197 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * Microbenchmark of the packet codec against the byte at a time
+ * functions remote.cc used before.  Not run by "make check"; run
+ * ./packetbench [MB] by hand.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "avarice.h"
+#include "packet.h"
+
+enum {
+    BLOCKSIZE = 256,		// a typical 'm' reply, in bytes
+};
+
+static const unsigned char hexchars[] = "0123456789abcdef";
+
+static int oldHex(unsigned char ch)
+{
+    if((ch >= 'a') && (ch <= 'f'))
+	return (ch - 'a' + 10);
+    if((ch >= '0') && (ch <= '9'))
+	return (ch - '0');
+    if((ch >= 'A') && (ch <= 'F'))
+	return (ch - 'A' + 10);
+    return (-1);
+}
+
+static __attribute__((noinline))
+char *oldMem2hex(const uchar *mem, char *buf, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+	*buf++ = hexchars[*mem >> 4];
+	*buf++ = hexchars[*mem++ & 0xf];
+    }
+    *buf = 0;
+
+    return (buf);
+}
+
+static __attribute__((noinline))
+uchar *oldHex2mem(const char *buf, uchar *mem, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+	unsigned char ch = oldHex(*buf++) << 4;
+	ch = ch + oldHex(*buf++);
+	*mem++ = ch;
+    }
+
+    return (mem);
+}
+
+static __attribute__((noinline))
+uchar oldChecksum(const char *data, int length)
+{
+    unsigned char checksum = 0;
+
+    for (int i = 0; i < length; i++)
+	checksum = checksum + data[i];
+
+    return checksum;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static volatile unsigned int sink;
+
+/** Keep the compiler from hoisting the work out of the loops **/
+#define clobber() __asm__ __volatile__("" : : : "memory")
+
+static void report(const char *what, double start, double megabytes)
+{
+    double secs = now() - start;
+
+    printf("%-28s %8.1f MB/s\n", what, secs > 0? megabytes / secs: 0);
+}
+
+int main(int argc, char **argv)
+{
+    double megabytes = argc > 1? atof(argv[1]): 64;
+    int rounds = (int)(megabytes * 1024 * 1024 / BLOCKSIZE);
+    static uchar mem[BLOCKSIZE], flash[BLOCKSIZE];
+    static char hexbuf[2 * BLOCKSIZE + 1], packed[2 * BLOCKSIZE];
+    double start;
+    // not a constant, so that neither side is specialized for it
+    volatile int blockSize = BLOCKSIZE;
+    int n = blockSize;
+
+    if (rounds <= 0)
+    {
+	fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+	return 1;
+    }
+
+    srand(1);
+    for (int i = 0; i < BLOCKSIZE; i++)
+	mem[i] = rand();
+    memset(flash, 0xff, sizeof flash);
+
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	sink += *oldMem2hex(mem, hexbuf, n);
+	clobber();
+    }
+    report("mem2hex, byte at a time", start, megabytes);
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	sink += *mem2hex(mem, hexbuf, n);
+	clobber();
+    }
+    report("mem2hex", start, megabytes);
+
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	sink += *oldHex2mem(hexbuf, mem, n);
+	clobber();
+    }
+    report("hex2mem, byte at a time", start, megabytes);
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	sink += *hex2mem(hexbuf, mem, n);
+	clobber();
+    }
+    report("hex2mem", start, megabytes);
+
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	sink += oldChecksum(hexbuf, 2 * n);
+	clobber();
+    }
+    report("checksum, byte at a time", start, 2 * megabytes);
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	sink += packetChecksum(hexbuf, 2 * n);
+	clobber();
+    }
+    report("packetChecksum", start, 2 * megabytes);
+
+    // Compression, measured on the hex text; erased flash compresses
+    // to a few bytes, random data not at all
+    int plength = 0;
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	plength = packetCompress(hexbuf, packed);
+	clobber();
+    }
+    report("packetCompress, random", start, 2 * megabytes);
+    printf("%-28s %8d -> %d bytes\n", "", 2 * BLOCKSIZE, plength);
+
+    mem2hex(flash, hexbuf, BLOCKSIZE);
+    start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+	plength = packetCompress(hexbuf, packed);
+	clobber();
+    }
+    report("packetCompress, erased", start, 2 * megabytes);
+    printf("%-28s %8d -> %d bytes\n", "", 2 * BLOCKSIZE, plength);
+
+    return 0;
+}
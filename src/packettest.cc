@@ -0,0 +1,185 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * Round trip test of the packet codec ("make check"): data is escaped
+ * with mem2bin, compressed with packetCompress, and decoded the way
+ * gdb does (read_frame expands runs on the raw packet data, escapes
+ * are undone afterwards).  The result must be the original data.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avarice.h"
+#include "packet.h"
+
+enum {
+    MAXDATA = 1024,
+    RLE_OFFSET = 29,		// see packet.cc
+    RLE_MAX_REPEAT = 126 - RLE_OFFSET,
+};
+
+static int failures;
+
+/** Expand 'length' bytes of packet data at 'in' into 'out' like gdb's
+    read_frame.  Return the expanded length, or -1 if gdb would reject
+    the packet. **/
+static int gdbExpand(const char *in, int length, char *out)
+{
+    int n = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+	if (in[i] == '#' || in[i] == '$')
+	    return -1;		// ends the packet early
+	if (in[i] != '*')
+	{
+	    out[n++] = in[i];
+	    continue;
+	}
+	if (n == 0 || i + 1 == length)
+	    return -1;
+
+	int repeat = (uchar)in[++i] - RLE_OFFSET;
+	if (repeat < 0 || in[i] == '#' || in[i] == '$' || (uchar)in[i] > 126)
+	    return -1;
+	memset(out + n, out[n - 1], repeat);
+	n += repeat;
+    }
+
+    return n;
+}
+
+/** Undo the escapes of mem2bin **/
+static int gdbUnescape(const char *in, int length, uchar *out)
+{
+    int n = 0;
+
+    for (int i = 0; i < length; i++)
+	if (in[i] == '}')
+	{
+	    if (++i == length)
+		return -1;
+	    out[n++] = in[i] ^ 0x20;
+	}
+	else
+	    out[n++] = in[i];
+
+    return n;
+}
+
+static void check(const char *what, const uchar *data, int count)
+{
+    static char escaped[2 * MAXDATA + 1], packed[2 * MAXDATA],
+	expanded[2 * MAXDATA];
+    static uchar decoded[MAXDATA];
+
+    int elength = mem2bin(data, escaped, count) - escaped;
+    int plength = packetCompress(escaped, packed);
+    int xlength = gdbExpand(packed, plength, expanded);
+
+    if (plength > elength)
+    {
+	printf("FAIL %s (%d bytes): compressed to %d > %d bytes\n",
+	       what, count, plength, elength);
+	failures++;
+    }
+    else if (xlength != elength || memcmp(expanded, escaped, elength) != 0)
+    {
+	printf("FAIL %s (%d bytes): gdb expands to %d bytes, expected %d\n",
+	       what, count, xlength, elength);
+	failures++;
+    }
+    else if (gdbUnescape(expanded, xlength, decoded) != count ||
+	     memcmp(decoded, data, count) != 0)
+    {
+	printf("FAIL %s (%d bytes): wrong data after unescaping\n",
+	       what, count);
+	failures++;
+    }
+}
+
+int main(void)
+{
+    static uchar data[MAXDATA];
+    char what[64];
+
+    // Runs of every length around the counts that would encode as
+    // '#' (6) and '$' (7), and around RLE_MAX_REPEAT
+    for (int length = 1; length <= 3 * (RLE_MAX_REPEAT + 1) + 2; length++)
+    {
+	memset(data, 0xff, length);
+	check("run of 0xff", data, length);
+	memset(data, 'a', length);
+	data[length] = 'b';
+	check("run before another character", data, length + 1);
+    }
+
+    // Runs of characters that must be escaped, or must not be run
+    // length encoded themselves
+    static const uchar special[] = { '#', '$', '}', '*', '\0', ']', 0x03 };
+    for (unsigned int i = 0; i < sizeof special; i++)
+	for (int length = 1; length <= RLE_MAX_REPEAT + 2; length++)
+	{
+	    memset(data, special[i], length);
+	    sprintf(what, "run of 0x%02x", special[i]);
+	    check(what, data, length);
+	}
+
+    // Runs right after an escape: "}]" is '}', and gdb must not
+    // repeat the escape character.  The run may be of the escaped
+    // character's second half, or of the escape character's.
+    static const uchar escapes[] = { '}', '#', '$', '*', '\0' };
+    static const uchar followers[] = { ']', 0x03, 0x04, '\n', ' ', 'a' };
+    for (unsigned int e = 0; e < sizeof escapes; e++)
+	for (unsigned int f = 0; f < sizeof followers; f++)
+	    for (int length = 0; length <= RLE_MAX_REPEAT + 2; length++)
+	    {
+		data[0] = escapes[e];
+		memset(data + 1, followers[f], length);
+		sprintf(what, "0x%02x then %d x 0x%02x",
+			escapes[e], length, followers[f]);
+		check(what, data, length + 1);
+	    }
+
+    // Random data from small alphabets, so there are many runs and
+    // escapes next to each other
+    static const uchar alphabet[] = { 'a', '}', ']', '*', '#', 0, 0xff };
+    srand(1);
+    for (int round = 0; round < 20000; round++)
+    {
+	int length = 1 + rand() % 300;
+	int symbols = 2 + rand() % (sizeof alphabet - 1);
+
+	for (int i = 0; i < length; )
+	{
+	    int run = 1 + rand() % (rand() % 4 == 0? 120: 8);
+	    uchar c = alphabet[rand() % symbols];
+
+	    while (run-- > 0 && i < length)
+		data[i++] = c;
+	}
+	check("random data", data, length);
+    }
+
+    if (failures)
+	printf("%d failures\n", failures);
+
+    return failures != 0;
+}
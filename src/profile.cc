@@ -0,0 +1,340 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file implements a statistical profiler: the running target is
+ * periodically stopped, its PC is sampled, and it is resumed.  The
+ * histogram is symbolized with the symbol table of the ELF file (when
+ * AVaRICE is built with libbfd).
+ *
+ * The AVR stack cannot be unwound without debug information, so each
+ * sample in the folded output is a single frame (the function).
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#if ENABLE_TARGET_PROGRAMMING
+#  include "autoconf.h"
+#  include <bfd.h>
+#endif
+
+#include "avarice.h"
+#include "jtag.h"
+#include "remote.h"
+#include "profile.h"
+
+struct profileSymbol
+{
+    unsigned long addr;
+    char *name;
+    unsigned long samples;
+};
+
+static profileSymbol *symbols;
+static int numSymbols;
+
+static int compareSymbolAddr(const void *a, const void *b)
+{
+    const profileSymbol *sa = (const profileSymbol *)a;
+    const profileSymbol *sb = (const profileSymbol *)b;
+
+    if (sa->addr != sb->addr)
+	return sa->addr < sb->addr? -1: 1;
+    return 0;
+}
+
+static int compareSymbolSamples(const void *a, const void *b)
+{
+    const profileSymbol *sa = (const profileSymbol *)a;
+    const profileSymbol *sb = (const profileSymbol *)b;
+
+    if (sa->samples != sb->samples)
+	return sa->samples > sb->samples? -1: 1;
+    return compareSymbolAddr(a, b);
+}
+
+static void freeSymbols(void)
+{
+    for (int i = 0; i < numSymbols; i++)
+	free(symbols[i].name);
+    delete [] symbols;
+    symbols = NULL;
+    numSymbols = 0;
+}
+
+/** Load the function symbols of 'elfFile', sorted by address **/
+static void loadSymbols(const char *elfFile)
+{
+#if ENABLE_TARGET_PROGRAMMING
+    bfd *file;
+    asymbol **syms;
+    long storage, count;
+
+    bfd_init();
+    file = bfd_openr(elfFile, NULL);
+    if (file == NULL || !bfd_check_format(file, bfd_object))
+    {
+	fprintf(stderr, "Cannot read symbols from %s\n", elfFile);
+	if (file != NULL)
+	    bfd_close(file);
+	return;
+    }
+
+    storage = bfd_get_symtab_upper_bound(file);
+    if (storage <= 0)
+    {
+	bfd_close(file);
+	return;
+    }
+    syms = (asymbol **)malloc(storage);
+    count = bfd_canonicalize_symtab(file, syms);
+
+    symbols = new profileSymbol[count > 0? count: 1];
+    for (long i = 0; i < count; i++)
+    {
+	asymbol *sym = syms[i];
+
+	// functions, or at least labels in code sections
+	if (!(sym->flags & (BSF_FUNCTION | BSF_GLOBAL | BSF_LOCAL)) ||
+	    (sym->flags & (BSF_SECTION_SYM | BSF_FILE | BSF_DEBUGGING)) ||
+	    sym->section == NULL || !(sym->section->flags & SEC_CODE))
+	    continue;
+
+	symbols[numSymbols].addr = bfd_asymbol_value(sym);
+	symbols[numSymbols].name = strdup(bfd_asymbol_name(sym));
+	symbols[numSymbols].samples = 0;
+	numSymbols++;
+    }
+    free(syms);
+    bfd_close(file);
+
+    qsort(symbols, numSymbols, sizeof *symbols, compareSymbolAddr);
+    debugOut("profile: %d code symbols from %s\n", numSymbols, elfFile);
+#else
+    fprintf(stderr, "AVaRICE was built without libbfd, cannot read "
+	    "symbols from %s\n", elfFile);
+#endif
+}
+
+/** Return the symbol containing 'pc', or NULL **/
+static profileSymbol *findSymbol(unsigned long pc)
+{
+    int lo = 0, hi = numSymbols - 1;
+    profileSymbol *found = NULL;
+
+    while (lo <= hi)
+    {
+	int mid = (lo + hi) / 2;
+
+	if (symbols[mid].addr <= pc)
+	{
+	    found = &symbols[mid];
+	    lo = mid + 1;
+	}
+	else
+	    hi = mid - 1;
+    }
+
+    return found;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/** Write the flat and folded profiles from 'histogram' **/
+static bool writeProfile(const char *prefix, unsigned long *histogram,
+			 unsigned long numWords, unsigned long total)
+{
+    char name[256];
+    FILE *flat, *folded;
+    unsigned long unknown = 0;
+
+    snprintf(name, sizeof name, "%s.flat", prefix);
+    flat = fopen(name, "w");
+    snprintf(name, sizeof name, "%s.folded", prefix);
+    folded = fopen(name, "w");
+    if (flat == NULL || folded == NULL)
+    {
+	fprintf(stderr, "Cannot write profile %s: %s\n", name,
+		strerror(errno));
+	if (flat != NULL)
+	    fclose(flat);
+	if (folded != NULL)
+	    fclose(folded);
+	return false;
+    }
+
+    fprintf(flat, "%% samples  samples  function\n");
+
+    if (numSymbols > 0)
+    {
+	for (unsigned long w = 0; w < numWords; w++)
+	{
+	    if (histogram[w] == 0)
+		continue;
+
+	    profileSymbol *sym = findSymbol(2 * w);
+	    if (sym != NULL)
+		sym->samples += histogram[w];
+	    else
+		unknown += histogram[w];
+	}
+
+	qsort(symbols, numSymbols, sizeof *symbols, compareSymbolSamples);
+	for (int i = 0; i < numSymbols && symbols[i].samples > 0; i++)
+	{
+	    fprintf(flat, "%8.2f %8lu  %s\n",
+		    100.0 * symbols[i].samples / total, symbols[i].samples,
+		    symbols[i].name);
+	    fprintf(folded, "%s %lu\n", symbols[i].name, symbols[i].samples);
+	}
+	if (unknown > 0)
+	{
+	    fprintf(flat, "%8.2f %8lu  [unknown]\n",
+		    100.0 * unknown / total, unknown);
+	    fprintf(folded, "[unknown] %lu\n", unknown);
+	}
+    }
+    else
+    {
+	// No symbols, report addresses.
+	for (unsigned long w = 0; w < numWords; w++)
+	{
+	    if (histogram[w] == 0)
+		continue;
+	    fprintf(flat, "%8.2f %8lu  0x%05lx\n",
+		    100.0 * histogram[w] / total, histogram[w], 2 * w);
+	    fprintf(folded, "0x%05lx %lu\n", 2 * w, histogram[w]);
+	}
+    }
+
+    fclose(flat);
+    fclose(folded);
+
+    return true;
+}
+
+bool profileTarget(double seconds, unsigned int rate, const char *elfFile,
+		   const char *prefix, bool stopAfter,
+		   char *summary, unsigned int summarySize)
+{
+    unsigned long numWords = theJtagICE->deviceDef->flash_page_size *
+	theJtagICE->deviceDef->flash_page_count / 2;
+    unsigned long *histogram = new unsigned long[numWords];
+    unsigned long samples = 0, outside = 0;
+    double interval = 1.0 / (rate > 0? rate: (unsigned int)PROFILE_DEFAULT_RATE);
+    double halted = 0, maxHalt = 0;
+    bool interrupted = false;
+
+    memset(histogram, 0, numWords * sizeof *histogram);
+    if (elfFile != NULL)
+	loadSymbols(elfFile);
+
+    statusOut("Profiling for %.1f s at %u samples/s\n", seconds,
+	      (unsigned int)(1.0 / interval + 0.5));
+
+    double start = now();
+    double next = start + interval;
+    double end = start + seconds;
+
+    try
+    {
+	theJtagICE->resumeProgram();
+
+	while (next < end && !interrupted)
+	{
+	    double t = now();
+
+	    if (next > t)
+		usleep((useconds_t)((next - t) * 1e6));
+	    next += interval;
+
+	    // Keep gdb, waiting for the monitor command to finish, from
+	    // timing out.
+	    if (gdbFileDescriptor != -1 && (int)(next - start) !=
+		(int)(next - interval - start))
+		gdbOut("profiling: %lu samples\n", samples);
+
+	    if (gdbFileDescriptor != -1)
+	    {
+		int c;
+
+		while ((c = checkForDebugChar()) >= 0)
+		    if (c == 3)
+		    {
+			debugOut("profiling interrupted by GDB\n");
+			interrupted = true;
+		    }
+	    }
+
+	    // Time the target spends stopped for this sample
+	    double stop = now();
+	    theJtagICE->interruptProgram();
+	    unsigned long pc = theJtagICE->getProgramCounter();
+	    theJtagICE->resumeProgram();
+	    double halt = now() - stop;
+
+	    halted += halt;
+	    if (halt > maxHalt)
+		maxHalt = halt;
+
+	    if (pc != PC_INVALID && pc / 2 < numWords)
+		histogram[pc / 2]++;
+	    else
+		outside++;
+	    samples++;
+	}
+
+	if (stopAfter)
+	    theJtagICE->interruptProgram();
+    }
+    catch (jtag_exception& e)
+    {
+	fprintf(stderr, "Profiling failed: %s\n", e.what());
+    }
+
+    double elapsed = now() - start;
+
+    if (samples > 0)
+	writeProfile(prefix, histogram, numWords, samples);
+    delete [] histogram;
+    freeSymbols();
+
+    snprintf(summary, summarySize,
+	     "%lu samples in %.2f s (%.1f/s)%s\n"
+	     "target halted %.1f ms total (%.2f%% of the time), "
+	     "%.2f ms per sample, %.2f ms max\n"
+	     "%lu samples outside flash\n"
+	     "profile written to %s.flat and %s.folded\n",
+	     samples, elapsed, samples / (elapsed > 0? elapsed: 1),
+	     interrupted? ", interrupted": "",
+	     halted * 1000, elapsed > 0? 100 * halted / elapsed: 0.0,
+	     samples > 0? halted * 1000 / samples: 0.0, maxHalt * 1000,
+	     outside, prefix, prefix);
+
+    return samples > 0;
+}
@@ -0,0 +1,48 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file declares the statistical PC sampling profiler.
+ *
+ * $Id$
+ */
+
+#ifndef INCLUDE_PROFILE_H
+#define INCLUDE_PROFILE_H
+
+enum {
+    PROFILE_DEFAULT_RATE = 100		// samples per second
+};
+
+/** Default prefix of the profile output files **/
+#define PROFILE_DEFAULT_PREFIX "avarice-profile"
+
+/** Let the (halted) target run for 'seconds', and sample its PC 'rate'
+    times per second by stopping and resuming it.  When 'stopAfter' is
+    set, the target is halted again at the end, otherwise it keeps
+    running.  A ^C from gdb ends the run early.
+
+    The histogram is symbolized with the symbols of 'elfFile' (may be
+    NULL), and written as a flat profile to '<prefix>.flat', and as
+    folded stacks to '<prefix>.folded'.  A summary, including how much
+    the sampling perturbed the target, is stored in 'summary'.
+
+    Returns false if no sample could be taken.
+**/
+bool profileTarget(double seconds, unsigned int rate, const char *elfFile,
+		   const char *prefix, bool stopAfter,
+		   char *summary, unsigned int summarySize);
+
+#endif /* INCLUDE_PROFILE_H */
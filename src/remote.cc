@@ -32,25 +32,39 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
 
 #include "avarice.h"
 #include "remote.h"
 #include "jtag.h"
+#include "agentexpr.h"
+#include "tracepoint.h"
+#include "profile.h"
+#include "packet.h"
 
 enum
 {
     /** BUFMAX defines the maximum number of characters in
      * inbound/outbound buffers at least NUMREGBYTES*2 are needed for
-     * register packets
+     * register packets.  The packet size announced to gdb is derived
+     * from the ICE's maximal memory transfer, but never exceeds this.
      */
-    BUFMAX      = 400,
+    BUFMAX      = 1024,
+
+    // packet overhead besides the payload of a memory transfer
+    // ("Xaaaaaaaa,llll:"), used to compute the PacketSize
+    PKTHDRMAX   = 32,
     NUMREGS     = 32/* + 1 + 1 + 1*/, /* SREG, FP, PC */
     SREG	= 32,
     SP		= 33,
     PC		= 34,
 
     // Number of bytes of registers.  See GDB gdb/avr-tdep.c
-    NUMREGBYTES = (NUMREGS + 1 + 2 + 4),
+    NUMREGBYTES = REGFILE_SIZE,
 
     // max number of bytes in a "monitor" command request
     MONMAX      = 100,
@@ -61,15 +75,137 @@ static char remcomOutBuffer[BUFMAX];
 
 static void ok();
 static void error(int n);
+static bool endGdbSession(void);
+static void gdbDisconnected(void);
 
 int gdbFileDescriptor = -1;
 
-void setGdbFile(int fd)
+/** Where replies to gdb go: gdbFileDescriptor, except in stdio mode **/
+static int gdbOutputDescriptor = -1;
+
+enum
+{
+    /** Size of the buffers between the packet layer and the gdb socket.
+     * Input is fetched in chunks of up to this size, output is
+     * collected per packet and handed to the kernel in one go.
+     */
+    GDB_IOBUFSIZE = 4096,
+};
+
+static uchar gdbInBuffer[GDB_IOBUFSIZE];
+static int gdbInHead, gdbInTail;   // unconsumed input is [head, tail)
+static char gdbOutBuffer[GDB_IOBUFSIZE];
+static int gdbOutLen;
+
+/** Set once gdb and we agreed on QStartNoAckMode: packets are neither
+    acknowledged nor retransmitted anymore. **/
+static bool noAckMode;
+
+/** Statistics about the gdb connection, see "monitor iostats" **/
+struct gdbIoCounters
+{
+    unsigned long readCalls, readBytes;
+    unsigned long writeCalls, writeBytes;
+    unsigned long packetsIn, packetsOut;
+};
+
+static gdbIoCounters gdbIoStats;
+
+/** Broker mode, see serveGdbClients().  The connection state above
+    belongs to the current client, the state of the others is parked
+    here meanwhile.  Client 0 controls the target.
+**/
+struct gdbClient
+{
+    int fd;
+    uchar input[GDB_IOBUFSIZE];	// unconsumed input
+    int inputLen;
+    bool noAckMode;
+    gdbIoCounters stats;
+    bool stopNotify;		// asked for %Stop notifications
+};
+
+enum
+{
+    MAX_GDB_CLIENTS = 8,
+};
+
+static gdbClient gdbClients[MAX_GDB_CLIENTS];
+static int numGdbClients;
+static int currentGdbClient = -1;
+static bool brokerMode;
+
+bool gdbExited;
+
+/** Set when the last client disconnected and the target was let run **/
+static bool targetReleased;
+
+/** Stop reply to send to the other clients as a notification.  gdb
+    only understands %Stop in non-stop mode, which is not supported, so
+    it goes only to clients that asked for it with
+    "Qavarice.StopNotify:1" (e.g. tools watching the target).  A gdb
+    observer has to poll with '?' instead.
+**/
+static bool stopPending;
+static char stopReply[BUFMAX];
+
+int acceptGdbConnection(int sock)
+{
+    union {
+	struct sockaddr sa;
+	struct sockaddr_in in;
+	struct sockaddr_un un;
+    } clientname;
+    socklen_t size = (socklen_t)sizeof(clientname);
+    int fd = accept(sock, &clientname.sa, &size);
+
+    if (fd < 0)
+	return -1;
+
+    if (clientname.sa.sa_family == AF_INET)
+    {
+	int tmp = 1;
+
+	// gdb waits for each reply; don't let Nagle hold it back.  The
+	// listening socket has these set already, but not every system
+	// passes them on to the accepted one.
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+		       (char *)&tmp, sizeof(tmp)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE,
+		       (char *)&tmp, sizeof(tmp)) < 0)
+	    debugOut("setsockopt failed: %s\n", strerror(errno));
+
+	statusOut("Connection opened by host %s, port %hu.\n",
+		  inet_ntoa(clientname.in.sin_addr),
+		  ntohs(clientname.in.sin_port));
+    }
+    else
+	statusOut("Connection opened.\n");
+
+    return fd;
+}
+
+void setGdbFile(int fd, int outFd)
 {
     gdbFileDescriptor = fd;
+    gdbOutputDescriptor = outFd >= 0? outFd: fd;
+    gdbInHead = gdbInTail = 0;
+    gdbOutLen = 0;
+    noAckMode = false;
+    memset(&gdbIoStats, 0, sizeof gdbIoStats);
     int ret = fcntl(gdbFileDescriptor, F_SETFL, O_NONBLOCK);
     if (ret < 0)
         throw jtag_exception();
+    if (gdbOutputDescriptor != gdbFileDescriptor &&
+	fcntl(gdbOutputDescriptor, F_SETFL, O_NONBLOCK) < 0)
+        throw jtag_exception();
+
+    // A new session of a persistent server: gdb expects a halted target
+    if (targetReleased)
+    {
+	theJtagICE->interruptProgram();
+	targetReleased = false;
+    }
 }
 
 static void waitForGdbOutput(void)
@@ -78,33 +214,72 @@ static void waitForGdbOutput(void)
     fd_set writefds;
 
     FD_ZERO (&writefds);
-    FD_SET (gdbFileDescriptor, &writefds);
+    FD_SET (gdbOutputDescriptor, &writefds);
 
-    numfds = select (gdbFileDescriptor + 1, 0, &writefds, 0, 0);
+    numfds = select (gdbOutputDescriptor + 1, 0, &writefds, 0, 0);
     if (numfds < 0)
         throw jtag_exception();
 }
 
-/** Send single char to gdb. Abort in case of problem. **/
-static void putDebugChar(char c)
+/** Write everything collected in gdbOutBuffer to gdb. Abort in case
+    of problem. **/
+static void flushDebugOutput(void)
 {
-    // This loop busy waits when it cannot write to gdb.
-    // But that shouldn't happen
-    for (;;)
-    {
-	int ret = write(gdbFileDescriptor, &c, 1);
+    int done = 0;
 
-	if (ret == 1)
-	    return;
+    while (done < gdbOutLen)
+    {
+	int ret = write(gdbOutputDescriptor, gdbOutBuffer + done,
+			gdbOutLen - done);
 
-	if (ret == 0) // this shouldn't happen?
-	    throw jtag_exception();
+	if (ret > 0)
+	{
+	    gdbIoStats.writeCalls++;
+	    gdbIoStats.writeBytes += ret;
+	    done += ret;
+	    continue;
+	}
 
-	if (errno != EAGAIN && ret < 0)
-	    throw jtag_exception();
+	if (ret == 0 || errno != EAGAIN) // ret == 0 shouldn't happen?
+	{
+	    gdbOutLen = 0;
+	    statusOut("Connection to gdb lost.\n");
+	    gdbDisconnected();
+	}
 
 	waitForGdbOutput();
     }
+    gdbOutLen = 0;
+}
+
+/** Queue single char for gdb. It is sent by the next
+    flushDebugOutput(), or when the buffer runs full. **/
+static void putDebugChar(char c)
+{
+    if (gdbOutLen == GDB_IOBUFSIZE)
+	flushDebugOutput();
+    gdbOutBuffer[gdbOutLen++] = c;
+}
+
+/** Queue 'length' chars at 'data' for gdb, like putDebugChar() **/
+static void putDebugData(const char *data, int length)
+{
+    while (length > 0)
+    {
+	int chunk = GDB_IOBUFSIZE - gdbOutLen;
+
+	if (chunk == 0)
+	{
+	    flushDebugOutput();
+	    continue;
+	}
+	if (chunk > length)
+	    chunk = length;
+	memcpy(gdbOutBuffer + gdbOutLen, data, chunk);
+	gdbOutLen += chunk;
+	data += chunk;
+	length -= chunk;
+    }
 }
 
 static void waitForGdbInput(void)
@@ -120,141 +295,122 @@ static void waitForGdbInput(void)
         throw jtag_exception();
 }
 
-/** Return single char read from gdb. Abort in case of problem,
+/** The gdb connection was closed: end the session, and abort whatever
+    was being done for gdb. **/
+static void gdbDisconnected(void)
+{
+    debugOut("gdb I/O: %lu reads (%lu bytes), %lu writes (%lu bytes), "
+	     "%lu packets in, %lu packets out\n",
+	     gdbIoStats.readCalls, gdbIoStats.readBytes,
+	     gdbIoStats.writeCalls, gdbIoStats.writeBytes,
+	     gdbIoStats.packetsIn, gdbIoStats.packetsOut);
+    gdbExited = true;
+    // in broker mode, let the remaining clients continue debugging
+    if (numGdbClients <= 1)
+	endGdbSession();
+    throw jtag_exception("gdb exited");
+}
+
+/** Refill gdbInBuffer with whatever gdb has sent so far. When 'wait'
+    is set, block until at least one byte is available. Return false
+    if nothing could be read without blocking. Abort in case of problem,
     exit cleanly if EOF detected on gdbFileDescriptor. **/
-int getDebugChar(void)
+static bool fillDebugInput(bool wait)
 {
-    uchar c = 0;
     int result;
 
-    do
+    // Never leave a reply sitting in our buffer while waiting for gdb.
+    flushDebugOutput();
+
+    for (;;)
     {
+	result = read(gdbFileDescriptor, gdbInBuffer, GDB_IOBUFSIZE);
+	if (result >= 0 || errno != EAGAIN)
+	    break;
+	if (!wait)
+	    return false;
 	waitForGdbInput();
-	result = read(gdbFileDescriptor, &c, 1);
     }
-    while (result < 0 && errno == EAGAIN);
 
-    if (result < 0)
+    if (result < 0 && errno != ECONNRESET)
         throw jtag_exception();
 
-    if (result == 0) // gdb exited
+    if (result <= 0) // gdb exited
     {
 	statusOut("gdb exited.\n");
-	theJtagICE->resumeProgram();
-        throw jtag_exception("gdb exited");
+	gdbDisconnected();
     }
 
-    return (int)c;
+    gdbIoStats.readCalls++;
+    gdbIoStats.readBytes += result;
+    gdbInHead = 0;
+    gdbInTail = result;
+
+    return true;
 }
 
-int checkForDebugChar(void)
+bool gdbInputPending(void)
 {
-    uchar c = 0;
-    int result;
-
-    result = read(gdbFileDescriptor, &c, 1);
-
-    if (result < 0 && errno == EAGAIN)
-	return -1;
-
-    if (result < 0)
-        throw jtag_exception();
-
-    if (result == 0) // gdb exited
-    {
-	statusOut("gdb exited.\n");
-	theJtagICE->resumeProgram();
-        throw jtag_exception("gdb exited");
-    }
-
-    return (int)c;
-}    
-
-static const unsigned char hexchars[] = "0123456789abcdef";
+    return gdbInHead < gdbInTail;
+}
 
-static char *byteToHex(uchar x, char *buf)
+/** Return single char read from gdb. Abort in case of problem,
+    exit cleanly if EOF detected on gdbFileDescriptor. **/
+int getDebugChar(void)
 {
-    *buf++ = hexchars[x >> 4];
-    *buf++ = hexchars[x & 0xf];
+    if (!gdbInputPending())
+	fillDebugInput(true);
 
-    return buf;
+    return (int)gdbInBuffer[gdbInHead++];
 }
 
-static int hex(unsigned char ch)
+int checkForDebugChar(void)
 {
-    if((ch >= 'a') && (ch <= 'f'))
-    {
-	return (ch - 'a' + 10);
-    }
-    if((ch >= '0') && (ch <= '9'))
-    {
-	return (ch - '0');
-    }
-    if((ch >= 'A') && (ch <= 'F'))
-    {
-	return (ch - 'A' + 10);
-    }
-    return (-1);
-}
+    if (!gdbInputPending() && !fillDebugInput(false))
+	return -1;
 
+    return (int)gdbInBuffer[gdbInHead++];
+}
 
-/** Convert hex string at '*ptr' to an integer.
-    Advances '*ptr' to 1st non-hex character found.
-    Returns number of characters used in conversion.
- **/
-static int hexToInt(char **ptr, int *intValue, int nMax = 0)
+/** Return gdb's CRC-32 (polynomial 0x04c11db7, most significant bit
+    first) of 'length' bytes of target memory at 'addr'. **/
+static unsigned int memoryCrc(unsigned int addr, unsigned int length)
 {
-    int numChars = 0;
-    int hexValue;
+    static unsigned int crcTable[256];
+    unsigned int crc = 0xffffffff;
+    uchar buf[1024];
 
-    *intValue = 0;
-    while (**ptr)
-    {
-	hexValue = hex(**ptr);
-	if(hexValue >= 0)
-	{
-	    *intValue = (*intValue << 4) | hexValue;
-	    numChars++;
-	}
-	else
+    if (crcTable[1] == 0)
+	for (unsigned int i = 0; i < 256; i++)
 	{
-	    break;
+	    unsigned int c = i << 24;
+
+	    for (int j = 0; j < 8; j++)
+		c = c & 0x80000000? (c << 1) ^ 0x04c11db7: c << 1;
+	    crcTable[i] = c;
 	}
-	(*ptr)++;
-        if (nMax != 0 && numChars >= nMax)
-            return numChars;
-    }
-    return (numChars);
-}
 
-/** Convert the memory pointed to by mem into hex, placing result in buf.
-    Return a pointer to the last char put in buf (null).
-**/
-static char *mem2hex(uchar *mem, char *buf, int count)
-{
-    for (int i = 0; i < count; i++)
-	buf = byteToHex(*mem++, buf);
-    *buf = 0;
+    while (length > 0)
+    {
+	unsigned int chunk = length > sizeof buf? sizeof buf: length;
+
+	theJtagICE->memoryRead(addr, chunk, buf);
+	for (unsigned int i = 0; i < chunk; i++)
+	    crc = (crc << 8) ^ crcTable[((crc >> 24) ^ buf[i]) & 0xff];
 
-    return (buf);
+	addr += chunk;
+	length -= chunk;
+    }
+
+    return crc;
 }
 
-/** Convert the hex array pointed to by buf into binary to be placed in mem.
-    Return a pointer to the character AFTER the last byte written.
-**/
-static uchar *hex2mem(char *buf, uchar *mem, int count)
+/** Return the PacketSize to announce to gdb in qSupported. **/
+static int packetSize(void)
 {
-    int i;
-    unsigned char ch;
-
-    for(i = 0; i < count; i++)
-    {
-	ch = hex(*buf++) << 4;
-	ch = ch + hex(*buf++);
-	*mem++ = ch;
-    }
+    int size = 2 * theJtagICE->maxMemoryTransfer() + PKTHDRMAX;
 
-    return (mem);
+    return size < BUFMAX? size: BUFMAX - 1;
 }
 
 static void putpacket(char *buffer);
@@ -296,47 +452,39 @@ void gdbOut(const char *fmt, ...)
 
     Reply with a packet of the form:
 
-      "Tss20:rr;21:llhh;22:aabbccdd;"
+      "Tss1c:yl;1d:yh;20:rr;21:llhh;22:aabbccdd;"
 
     where (all values in hex):
       ss       = signal number (usually SIGTRAP)
+      yl, yh   = r28, r29 (frame pointer)
       rr       = SREG value
       llhh     = SPL:SPH  (stack pointer)
       aabbccdd = PC (program counter)
 
-    This actually saves having to read the 32 general registers when stepping
-    over code since gdb won't send a 'g' packet until the PC it is hunting for
-    is found.  */
+    gdb won't send a 'g' packet until the PC it is hunting for is found,
+    and with the frame pointer included it can also unwind the current
+    frame from this reply alone, so stepping costs a single round trip
+    per instruction.  */
 
 static void reportStatusExtended(int sigval)
 {
-    uchar *jtagBuffer;
-    unsigned int pc = theJtagICE->getProgramCounter();
+    uchar regBuffer[NUMREGBYTES];
 
-    // Read in SPL SPH SREG
-    jtagBuffer = theJtagICE->jtagRead(theJtagICE->statusAreaAddress(), 0x03);
-
-    if (jtagBuffer)
-    {
-        // We have SPL SPH SREG and need SREG SPL SPH
-
-        snprintf (remcomOutBuffer, sizeof(remcomOutBuffer),
-                  "T%02x" "20:%02x;" "21:%02x%02x;" "22:%02x%02x%02x%02x;",
-                  sigval & 0xff,
-                  jtagBuffer[2], // SREG
-                  jtagBuffer[0], // SPL
-                  jtagBuffer[1], // SPH
-                  pc & 0xff, (pc >> 8) & 0xff,
-                  (pc >> 16) & 0xff, (pc >> 24) & 0xff);
-
-        delete [] jtagBuffer;
-        jtagBuffer = 0;
-    }
-    else
+    if (!theJtagICE->readRegisterFile(regBuffer))
     {
         error(1);
         return;
     }
+
+    snprintf (remcomOutBuffer, sizeof(remcomOutBuffer),
+              "T%02x" "1c:%02x;" "1d:%02x;" "20:%02x;" "21:%02x%02x;"
+              "22:%02x%02x%02x%02x;",
+              sigval & 0xff,
+              regBuffer[28], regBuffer[29],
+              regBuffer[REGFILE_SREG],
+              regBuffer[REGFILE_SP], regBuffer[REGFILE_SP + 1],
+              regBuffer[REGFILE_PC], regBuffer[REGFILE_PC + 1],
+              regBuffer[REGFILE_PC + 2], regBuffer[REGFILE_PC + 3]);
 }
 
 /** Fill 'remcomOutBuffer' with a status report for signal 'sigval' **/
@@ -357,27 +505,21 @@ static void reportStatus(int sigval)
 // little-endian word read
 unsigned int readLWord(unsigned int address)
 {
-    unsigned char *mem = theJtagICE->jtagRead(DATA_SPACE_ADDR_OFFSET + address, 2);
+    uchar mem[2];
 
-    if (!mem)
-	return 0;		// hmm
+    theJtagICE->jtagRead(DATA_SPACE_ADDR_OFFSET + address, 2, mem);
 
-    unsigned int val = mem[0] | mem[1] << 8;
-    delete[] mem;
-    return val;
+    return mem[0] | mem[1] << 8;
 }
 
 // big-endian word read
 unsigned int readBWord(unsigned int address)
 {
-    unsigned char *mem = theJtagICE->jtagRead(DATA_SPACE_ADDR_OFFSET + address, 2);
+    uchar mem[2];
 
-    if (!mem)
-	return 0;		// hmm
+    theJtagICE->jtagRead(DATA_SPACE_ADDR_OFFSET + address, 2, mem);
 
-    unsigned int val = mem[0] << 8 | mem[1];
-    delete[] mem;
-    return val;
+    return mem[0] << 8 | mem[1];
 }
 
 unsigned int readSP(void)
@@ -426,11 +568,137 @@ bool handleInterrupt(void)
     return result;
 }
 
+/** Data watchpoints set by gdb.  Those the ICE has no room for (or
+    cannot express, like unaligned ranges) are emulated in software: as
+    long as there is one, the target is single-stepped, and the watched
+    memory compared to a copy taken before it was resumed.  The
+    watchpoints held by the ICE are compared as well, because the ICE
+    does not report them while stepping.
+**/
+struct watchpoint
+{
+    unsigned int addr;
+    unsigned int length;
+    bpType type;
+    bool hardware;		// held by the ICE
+    uchar *value;		// memory contents before resuming
+    watchpoint *next;
+};
+
+enum {
+    MAX_SOFT_WATCH_LENGTH = 64
+};
+
+static watchpoint *watchpoints;
+static watchpoint *watchHit;	// reported with the next stop
+
+/** Record watchpoint 'type' at 'addr'.  If 'hardware' is not set, it
+    is emulated in software, which is only possible for watchpoints on
+    writes: reads do not change memory.  Return false if the
+    watchpoint cannot be set. **/
+static bool addWatchpoint(unsigned int addr, bpType type, unsigned int length,
+			  bool hardware)
+{
+    if (!hardware &&
+	(type == READ_DATA || length == 0 || length > MAX_SOFT_WATCH_LENGTH))
+	return false;
+
+    watchpoint *w = new watchpoint;
+    w->addr = addr;
+    w->length = length;
+    w->type = type;
+    w->hardware = hardware;
+    w->value = new uchar[length > 0? length: 1];
+    w->next = watchpoints;
+    watchpoints = w;
+    if (!hardware)
+	debugOut("software watchpoint at 0x%x, %u bytes\n", addr, length);
+
+    return true;
+}
+
+/** Forget watchpoint 'type' at 'addr'.  Return true if it was held by
+    the ICE (or is unknown), i.e. has to be deleted there. **/
+static bool deleteWatchpoint(unsigned int addr, bpType type)
+{
+    for (watchpoint **wp = &watchpoints; *wp != NULL; wp = &(*wp)->next)
+    {
+	watchpoint *w = *wp;
+
+	if (w->addr == addr && w->type == type)
+	{
+	    bool hardware = w->hardware;
+
+	    *wp = w->next;
+	    if (watchHit == w)
+		watchHit = NULL;
+	    delete [] w->value;
+	    delete w;
+	    return hardware;
+	}
+    }
+
+    return true;
+}
+
+/** True if there is a watchpoint to emulate in software **/
+static bool softWatching(void)
+{
+    for (watchpoint *w = watchpoints; w != NULL; w = w->next)
+	if (!w->hardware)
+	    return true;
+
+    return false;
+}
+
+/** Copy the watched memory, before resuming the target **/
+static void watchSnapshot(void)
+{
+    watchHit = NULL;
+    for (watchpoint *w = watchpoints; w != NULL; w = w->next)
+	if (w->type != READ_DATA)
+	    theJtagICE->memoryRead(w->addr, w->length, w->value);
+}
+
+/** Compare the watched memory with the copy.  Return true (and set
+    'watchHit') if it changed. **/
+static bool watchChanged(void)
+{
+    uchar now[MAX_SOFT_WATCH_LENGTH];
+
+    for (watchpoint *w = watchpoints; w != NULL; w = w->next)
+    {
+	unsigned int length = w->length;
+
+	if (w->type == READ_DATA)
+	    continue;
+	if (length > MAX_SOFT_WATCH_LENGTH)
+	    length = MAX_SOFT_WATCH_LENGTH;
+
+	theJtagICE->memoryRead(w->addr, length, now);
+	if (memcmp(now, w->value, length) != 0)
+	{
+	    debugOut("watched memory at 0x%x changed\n", w->addr);
+	    memcpy(w->value, now, length);
+	    watchHit = w;
+	    return true;
+	}
+    }
+
+    return false;
+}
+
 static bool singleStep()
 {
+    bool watching = softWatching();
+
     try
     {
+	if (watching)
+	    watchSnapshot();
         theJtagICE->jtagSingleStep();
+	if (watching && watchChanged())
+	    return true;
     }
     catch (jtag_exception& e)
     {
@@ -447,6 +715,275 @@ static bool singleStep()
     return true;
 }
 
+/** Step while the PC stays within [start, end), on behalf of a
+    vCont;r request.  This saves gdb a round trip for each instruction
+    of a source line.  Return false if gdb interrupted the stepping.
+**/
+static bool rangeStep(unsigned int start, unsigned int end)
+{
+    int steps = 0;
+    bool watching = softWatching();
+
+    for (;;)
+    {
+	bool changed = false;
+
+	try
+	{
+	    if (watching && steps == 0)
+		watchSnapshot();
+	    theJtagICE->jtagSingleStep();
+	    changed = watching && watchChanged();
+	}
+	catch (jtag_exception& e)
+	{
+	    gdbOut("Failed to single-step");
+	    return true;
+	}
+	steps++;
+	if (changed)
+	    break;
+
+	unsigned int newPC = theJtagICE->getProgramCounter();
+	if (theJtagICE->codeBreakpointAt(newPC))
+	    break;
+	// assume interrupt when PC goes into interrupt table
+	if (ignoreInterrupts && newPC < theJtagICE->deviceDef->vectors_end)
+	{
+	    if (!handleInterrupt())
+		return false;
+	    newPC = theJtagICE->getProgramCounter();
+	}
+	if (newPC < start || newPC >= end)
+	    break;
+
+	int c = checkForDebugChar();
+	if (c == 3) // interrupt
+	{
+	    debugOut("range step interrupted by GDB\n");
+	    return false;
+	}
+	else if (c >= 0)
+	    debugOut("Unexpected GDB input `%02x'\n", c);
+    }
+    debugOut("range step: %d steps in [0x%x, 0x%x)\n", steps, start, end);
+
+    return true;
+}
+
+/** Conditions of code breakpoints, as agent expressions.  The target
+    only stops at such a breakpoint if one of its conditions is true.
+**/
+struct bpCondition
+{
+    unsigned int addr;
+    unsigned int length;
+    uchar *code;
+    bpCondition *next;
+};
+
+static bpCondition *bpConditions;
+
+static void clearConditions(unsigned int addr)
+{
+    bpCondition **cp = &bpConditions;
+
+    while (*cp != NULL)
+    {
+	bpCondition *c = *cp;
+
+	if (c->addr == addr)
+	{
+	    *cp = c->next;
+	    delete [] c->code;
+	    delete c;
+	}
+	else
+	    cp = &c->next;
+    }
+}
+
+/** Parse the condition list ";X<len>,<expr>..." of a Z packet at
+    'ptr', and attach it to the breakpoint at 'addr', replacing the
+    previous conditions.  Return false if the list is malformed. **/
+static bool parseConditions(char *ptr, unsigned int addr)
+{
+    clearConditions(addr);
+
+    while (ptr[0] == ';' && ptr[1] == 'X')
+    {
+	int len;
+
+	ptr += 2;
+	if (!hexToInt(&ptr, &len) || *ptr++ != ',' ||
+	    len <= 0 || (int)strlen(ptr) < 2 * len)
+	{
+	    clearConditions(addr);
+	    return false;
+	}
+
+	bpCondition *c = new bpCondition;
+	c->addr = addr;
+	c->length = len;
+	c->code = new uchar[len];
+	for (int j = 0; j < len; j++, ptr += 2)
+	    c->code[j] = (hex(ptr[0]) << 4) + hex(ptr[1]);
+	c->next = bpConditions;
+	bpConditions = c;
+	debugOut("condition of %d bytes for breakpoint at 0x%x\n", len, addr);
+    }
+    // a ";cmds:..." part (BreakpointCommands) is not supported
+
+    return true;
+}
+
+/** Return true if the target should stop at 'pc', that is, there is
+    no breakpoint condition at 'pc', or one of them is true.  A
+    condition that cannot be evaluated counts as true. **/
+static bool conditionHolds(unsigned int pc)
+{
+    bool conditional = false;
+
+    for (bpCondition *c = bpConditions; c != NULL; c = c->next)
+    {
+	if (c->addr != pc)
+	    continue;
+	conditional = true;
+
+	long long result;
+	if (!axEvaluate(c->code, c->length, result) || result != 0)
+	    return true;
+    }
+
+    return !conditional;
+}
+
+/** The last client detached or disconnected: remove the breakpoints
+    it left behind, and let the target run.  Nothing is done if the
+    target was released already.  Returns false if the ICE failed;
+    the next session halts the target all the same. **/
+static bool endGdbSession(void)
+{
+    bool released = true;
+
+    if (targetReleased)
+	return true;
+
+    while (bpConditions != NULL)
+	clearConditions(bpConditions->addr);
+    while (watchpoints != NULL)
+	deleteWatchpoint(watchpoints->addr, watchpoints->type);
+    traceRelease();
+
+    try
+    {
+	theJtagICE->deleteAllBreakpoints();
+	theJtagICE->updateBreakpoints();
+	theJtagICE->resumeProgram();
+    }
+    catch (jtag_exception& e)
+    {
+	debugOut("Failed to release the target: %s\n", e.what());
+	released = false;
+    }
+    targetReleased = true;
+
+    return released;
+}
+
+/** Continue the target by single-stepping it, for software
+    watchpoints: stop when watched memory changes, or at a breakpoint
+    whose condition holds.  Return false if gdb interrupted the target.
+**/
+static bool watchContinue(void)
+{
+    int steps = 0;
+
+    for (;;)
+    {
+	unsigned int pc;
+
+	try
+	{
+	    if (steps == 0)
+		watchSnapshot();
+	    theJtagICE->jtagSingleStep();
+	    steps++;
+
+	    pc = theJtagICE->getProgramCounter();
+	    // assume interrupt when PC goes into interrupt table
+	    if (ignoreInterrupts && pc < theJtagICE->deviceDef->vectors_end &&
+		!theJtagICE->codeBreakpointAt(pc))
+	    {
+		if (!handleInterrupt())
+		    return false;
+		pc = theJtagICE->getProgramCounter();
+	    }
+
+	    if (watchChanged())
+		break;
+	}
+	catch (jtag_exception& e)
+	{
+	    gdbOut("Failed to single-step");
+	    break;
+	}
+
+	if (theJtagICE->codeBreakpointAt(pc) &&
+	    !traceHit(pc) && conditionHolds(pc))
+	    break;
+
+	int c = checkForDebugChar();
+	if (c == 3) // interrupt
+	{
+	    debugOut("watchpoint stepping interrupted by GDB\n");
+	    return false;
+	}
+	else if (c >= 0)
+	    debugOut("Unexpected GDB input `%02x'\n", c);
+    }
+    debugOut("software watchpoints: %d steps\n", steps);
+
+    return true;
+}
+
+/** Continue the target until it stops at a breakpoint whose condition
+    holds.  Where the condition is false, or the breakpoint is a
+    tracepoint, it is stepped off the breakpoint and resumed right away,
+    without bothering gdb.  Return false if gdb interrupted the target.
+**/
+static bool continueProgram(void)
+{
+    if (softWatching())
+	return watchContinue();
+
+    bool result = theJtagICE->jtagContinue();
+
+    while (result)
+    {
+	unsigned int pc = theJtagICE->getProgramCounter();
+
+	if (!theJtagICE->codeBreakpointAt(pc) ||
+	    (!traceHit(pc) && conditionHolds(pc)))
+	    break;
+
+	debugOut("resuming at 0x%x\n", pc);
+	try
+	{
+	    theJtagICE->jtagSingleStep();
+	}
+	catch (jtag_exception& e)
+	{
+	    gdbOut("Failed to single-step");
+	    break;
+	}
+	if (!theJtagICE->codeBreakpointAt(theJtagICE->getProgramCounter()))
+	    result = theJtagICE->jtagContinue();
+    }
+
+    return result;
+}
+
 /** Read packet from gdb into remcomInBuffer, check checksum and confirm
     reception to gdb.
     Return pointer to null-terminated, actual packet data (without $, #,
@@ -515,29 +1052,41 @@ static char *getpacket(int &len)
 	    {
 		char buf[16];
 
-		mem2hex(&checksum, buf, 4);
+		mem2hex(&checksum, buf, 1);
 		gdbOut("Bad checksum: my count = %s, ", buf);
-		mem2hex(&xmitcsum, buf, 4);
+		mem2hex(&xmitcsum, buf, 1);
 		gdbOut("sent count = %s\n", buf);
 		gdbOut(" -- Bad buffer: \"%s\"\n", buffer);
 
-		putDebugChar('-');	// failed checksum
+		if (!noAckMode)
+		{
+		    putDebugChar('-');	// failed checksum
+		    flushDebugOutput();
+		}
 	    }
 	    else
 	    {
-		putDebugChar('+');	// successful transfer
+		if (!noAckMode)
+		    putDebugChar('+');	// successful transfer
+
+		gdbIoStats.packetsIn++;
 
 		// if a sequence char is present, reply the sequence ID
 		if(buffer[2] == ':')
 		{
-		    putDebugChar(buffer[0]);
-		    putDebugChar(buffer[1]);
+		    if (!noAckMode)
+		    {
+			putDebugChar(buffer[0]);
+			putDebugChar(buffer[1]);
+		    }
+		    flushDebugOutput();
 
 		    len = count - 3;
 
 		    return &buffer[3];
 		}
 
+		flushDebugOutput();
 		len = count;
 		return &buffer[0];
 	    }
@@ -545,30 +1094,40 @@ static char *getpacket(int &len)
     }
 }
 
+/** Queue 'buffer' for gdb as a packet starting with 'start' ('$' or
+    '%'): run-length encoded, with # and checksum appended. **/
+static void putframe(char start, const char *buffer)
+{
+    // large enough for the hex encoded console output of vgdbOut()
+    static char frame[2 * BUFMAX + 4];
+    int length;
+
+    frame[0] = start;
+    length = packetCompress(buffer, frame + 1);
+    frame[length + 1] = '#';
+    byteToHex(packetChecksum(frame + 1, length), frame + length + 2);
+    putDebugData(frame, length + 4);
+}
+
 /** Send packet 'buffer' to gdb. Adds $, # and checksum wrappers. **/
 static void putpacket(char *buffer)
 {
-    unsigned char checksum;
-    int count;
-    char ch;
-
     //  $<packet info>#<checksum>.
     do
     {
-	putDebugChar('$');
-	checksum = 0;
-	count = 0;
+	putframe('$', buffer);
+	flushDebugOutput();
+	gdbIoStats.packetsOut++;
+    } while(!noAckMode && getDebugChar() != '+'); // wait for the ACK
+}
 
-	while((ch = buffer[count]))
-	{
-	    putDebugChar(ch);
-	    checksum += ch;
-	    count += 1;
-	}
-	putDebugChar('#');
-	putDebugChar(hexchars[checksum >> 4]);
-	putDebugChar(hexchars[checksum % 16]);
-    } while(getDebugChar() != '+'); // wait for the ACK
+/** Send notification 'buffer' (e.g. "Stop:T05...") to gdb.  Adds %, #
+    and checksum wrappers.  Notifications are not acknowledged. **/
+static void putnotification(const char *buffer)
+{
+    putframe('%', buffer);
+    flushDebugOutput();
+    gdbIoStats.packetsOut++;
 }
 
 /** Set remcomOutBuffer to "ok" response */
@@ -577,79 +1136,329 @@ static void ok()
     strcpy(remcomOutBuffer, "OK");
 }
 
-/** Set remcomOutBuffer to error 'n' response */
-static void error(int n)
+/** Set remcomOutBuffer to error 'n' response */
+static void error(int n)
+{
+    char *ptr = remcomOutBuffer;
+
+    *ptr++ = 'E';
+    ptr = byteToHex(n, ptr);
+    *ptr = '\0';
+}
+
+// put "s" into remcomOutBuffer, obeying the packet size limit
+static void replyString(const char *s)
+{
+    unsigned int i = 0;
+    char c, *ptr;
+
+    ptr = remcomOutBuffer;
+    while ((c = *s++) != 0 && i < BUFMAX - 1)
+    {
+        ptr = byteToHex((int)c, ptr);
+        i += 2;
+    }
+    *ptr = '\0';
+}
+
+/** reply to a "monitor" command */
+static bool monitor(const char *cmd)
+{
+    unsigned int ln = strlen(cmd);
+    if (strncmp(cmd, "help", ln) == 0 ||
+        strcmp(cmd, "?") == 0)
+    {
+        replyString("AVaRICE commands:\n"
+                    "help, ?:   get help\n"
+                    "version:   ask AVaRICE version\n"
+                    "reset:     reset target\n"
+                    "iostats:   gdb connection I/O statistics\n"
+                    "profile [secs [rate [elf-file]]]:\n"
+                    "           run the target, and sample its PC\n");
+        return true;
+    }
+
+    if (strncmp(cmd, "version", ln) == 0)
+    {
+        char reply[80];
+        sprintf(reply, "AVaRICE version %s, %s %s\n",
+                PACKAGE_VERSION, __DATE__, __TIME__);
+        replyString(reply);
+        return true;
+    }
+
+    if (strncmp(cmd, "iostats", ln) == 0)
+    {
+        char reply[BUFMAX / 2];
+        snprintf(reply, sizeof reply,
+                 "%lu reads (%lu bytes), %lu writes (%lu bytes)\n"
+                 "%lu packets in, %lu packets out\n",
+                 gdbIoStats.readCalls, gdbIoStats.readBytes,
+                 gdbIoStats.writeCalls, gdbIoStats.writeBytes,
+                 gdbIoStats.packetsIn, gdbIoStats.packetsOut);
+        replyString(reply);
+        return true;
+    }
+
+    if (strncmp(cmd, "profile", 7) == 0 && (cmd[7] == ' ' || cmd[7] == '\0'))
+    {
+        double seconds = 5;
+        unsigned int rate = PROFILE_DEFAULT_RATE;
+        char elfFile[MONMAX] = "";
+        char reply[BUFMAX / 2];
+
+        sscanf(cmd + 7, "%lf %u %s", &seconds, &rate, elfFile);
+        if (seconds <= 0 || rate == 0)
+        {
+            replyString("usage: profile [secs [rate [elf-file]]]\n");
+            return true;
+        }
+        // The target is stopped again afterwards, at a different PC.
+        profileTarget(seconds, rate, elfFile[0]? elfFile: NULL,
+                      PROFILE_DEFAULT_PREFIX, true, reply, sizeof reply);
+        replyString(reply);
+        return true;
+    }
+
+    if (strncmp(cmd, "reset", ln) == 0)
+    {
+        try
+        {
+            theJtagICE->resetProgram(false);
+            replyString("Resetting MCU...\n");
+        }
+        catch (jtag_exception& e)
+        {
+            char reply[80];
+            sprintf(reply, "Failed to reset MCU: %s\n",
+                    e.what());
+            replyString(reply);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+
+/** State of a flash download by gdb (vFlashErase, vFlashWrite,
+    vFlashDone).  gdb sends the data in ascending address order, so
+    each page below the end of the most recent vFlashWrite is final,
+    and is programmed right after the reply has been sent.
+**/
+static struct
+{
+    uchar *buf;			// flash image, 0xff where not written
+    int size;			// size of the flash
+    int pageSize;
+    int committed;		// pages below this offset are programmed
+    int end;			// end of the most recent vFlashWrite
+    int top;			// end of all data written
+    bool failed;		// programming a page failed
+    bool incremental;		// only changed pages are programmed
+} flashLoad;
+
+/** Reprogram the flash page at 'offset' if it changed.  If that needs
+    a page erase the device does not have, erase the chip instead, and
+    program everything again from the start. **/
+static void flashUpdate(int offset)
+{
+    uchar *page = flashLoad.buf + offset;
+
+    if (theJtagICE->updatePage(offset, flashLoad.pageSize, page) !=
+	jtag::PAGE_NEEDS_CHIP_ERASE)
+	return;
+
+    debugOut("no page erase, erasing the chip\n");
+    theJtagICE->eraseProgramMemory();
+    flashLoad.incremental = false;
+    flashLoad.committed = 0;
+}
+
+static bool pageIsBlank(const uchar *page, int pagesize)
+{
+    for (int i = 0; i < pagesize; i++)
+	if (page[i] != 0xff)
+	    return false;
+
+    return true;
+}
+
+/** Program all pages from flashLoad.committed up to 'upto', skipping
+    blank pages (the flash has been erased before).  Consecutive pages
+    are written in one go, so the ICE can pipeline them.  For
+    incremental programming, nothing has been erased, and each page is
+    compared against the target instead. **/
+static void flashCommit(int upto)
+{
+    int pagesize = flashLoad.pageSize;
+
+    if (flashLoad.buf == NULL)
+	return;
+
+    while (flashLoad.committed < upto)
+    {
+	uchar *page = flashLoad.buf + flashLoad.committed;
+	int pages = 1;
+
+	if (flashLoad.incremental)
+	{
+	    if (!flashLoad.failed)
+	    {
+		debugOut("programming page @ 0x%x\n", flashLoad.committed);
+		try
+		{
+		    flashUpdate(flashLoad.committed);
+		}
+		catch (jtag_exception& e)
+		{
+		    fprintf(stderr, "Failed to program flash page at 0x%x: %s\n",
+			    flashLoad.committed, e.what());
+		    flashLoad.failed = true;
+		}
+		if (!flashLoad.incremental)
+		    // the chip has been erased, start over
+		    continue;
+	    }
+	}
+	else if (!pageIsBlank(page, pagesize))
+	{
+	    while (pages < MAX_PAGES_PER_WRITE &&
+		   flashLoad.committed + pages * pagesize < upto &&
+		   !pageIsBlank(page + pages * pagesize, pagesize))
+		pages++;
+
+	    if (!flashLoad.failed)
+	    {
+		debugOut("programming %d page(s) @ 0x%x\n",
+			 pages, flashLoad.committed);
+		try
+		{
+		    theJtagICE->jtagWritePages(flashLoad.committed, pagesize,
+					       pages, page);
+		}
+		catch (jtag_exception& e)
+		{
+		    fprintf(stderr, "Failed to program flash at 0x%x: %s\n",
+			    flashLoad.committed, e.what());
+		    flashLoad.failed = true;
+		}
+	    }
+	}
+	flashLoad.committed += pages * pagesize;
+    }
+}
+
+/** Start a flash download: erase the chip (unless programming
+    incrementally), and set up the image buffer.  gdb might erase
+    several regions in one download, only the first one is acted
+    upon. **/
+static void flashStart(void)
 {
-    char *ptr = remcomOutBuffer;
-
-    *ptr++ = 'E';
-    ptr = byteToHex(n, ptr);
-    *ptr = '\0';
+    if (flashLoad.buf != NULL)
+	return;
+
+    flashLoad.pageSize = theJtagICE->deviceDef->flash_page_size;
+    flashLoad.size = flashLoad.pageSize *
+	theJtagICE->deviceDef->flash_page_count;
+    flashLoad.committed = flashLoad.end = flashLoad.top = 0;
+    flashLoad.failed = false;
+    flashLoad.incremental = incrementalProgramming;
+
+    theJtagICE->invalidateCaches();
+    theJtagICE->enableProgramming();
+    if (!flashLoad.incremental)
+	theJtagICE->eraseProgramMemory();
+
+    flashLoad.buf = new uchar[flashLoad.size];
+    memset(flashLoad.buf, 0xff, flashLoad.size);
 }
 
-// put "s" into remcomOutBuffer, obeying the packet size limit
-static void replyString(const char *s)
+/** Buffer 'amount' bytes of flash data for 'offset'. Return false if
+    the data cannot be accepted, or programming failed so far. **/
+static bool flashWrite(int offset, int amount, uchar *data)
 {
-    unsigned int i = 0;
-    char c, *ptr;
+    if (flashLoad.buf == NULL || offset < 0 || amount < 0 ||
+	offset + amount > flashLoad.size)
+	return false;
 
-    ptr = remcomOutBuffer;
-    while ((c = *s++) != 0 && i < BUFMAX - 1)
+    memcpy(flashLoad.buf + offset, data, amount);
+
+    if (offset < flashLoad.committed)
     {
-        ptr = byteToHex((int)c, ptr);
-        i += 2;
+	// Out of order: the pages concerned have already been
+	// handled, reprogram them.
+	int pagesize = flashLoad.pageSize;
+	int page = offset & ~(pagesize - 1);
+	int last = offset + amount < flashLoad.committed?
+	    offset + amount: flashLoad.committed;
+
+	debugOut("out of order flash write @ 0x%x\n", offset);
+	try
+	{
+	    for (; page < last && page < flashLoad.committed; page += pagesize)
+		flashUpdate(page);
+	}
+	catch (jtag_exception& e)
+	{
+	    flashLoad.failed = true;
+	}
     }
-    *ptr = '\0';
+    else if (offset + amount > flashLoad.end)
+	flashLoad.end = offset + amount;
+    if (offset + amount > flashLoad.top)
+	flashLoad.top = offset + amount;
+
+    return !flashLoad.failed;
 }
 
-/** reply to a "monitor" command */
-static bool monitor(const char *cmd)
+/** Program what is left of a flash download, and leave programming
+    mode. Return false if any page could not be programmed.  On
+    success, the image becomes the flash shadow of the ICE. **/
+static bool flashDone(void)
 {
-    unsigned int ln = strlen(cmd);
-    if (strncmp(cmd, "help", ln) == 0 ||
-        strcmp(cmd, "?") == 0)
-    {
-        replyString("AVaRICE commands:\n"
-                    "help, ?:   get help\n"
-                    "version:   ask AVaRICE version\n"
-                    "reset:     reset target\n");
-        return true;
-    }
+    bool result;
 
-    if (strncmp(cmd, "version", ln) == 0)
+    if (flashLoad.buf == NULL)
+	return false;
+
+    flashCommit((flashLoad.top + flashLoad.pageSize - 1) &
+		~(flashLoad.pageSize - 1));
+    result = !flashLoad.failed;
+    try
     {
-        char reply[80];
-        sprintf(reply, "AVaRICE version %s, %s %s\n",
-                PACKAGE_VERSION, __DATE__, __TIME__);
-        replyString(reply);
-        return true;
+	theJtagICE->disableProgramming();
     }
-
-    if (strncmp(cmd, "reset", ln) == 0)
+    catch (jtag_exception& e)
     {
-        try
-        {
-            theJtagICE->resetProgram(false);
-            replyString("Resetting MCU...\n");
-        }
-        catch (jtag_exception& e)
-        {
-            char reply[80];
-            sprintf(reply, "Failed to reset MCU: %s\n",
-                    e.what());
-            replyString(reply);
-        }
-        return true;
+	result = false;
     }
+    // Only the pages up to the last one written are known: when
+    // programming incrementally, the rest has not been erased.
+    if (result)
+	theJtagICE->setFlashShadow(flashLoad.buf, flashLoad.committed);
+    else
+	delete [] flashLoad.buf;
+    flashLoad.buf = NULL;
 
-    return false;
+    return result;
 }
 
-
 static void repStatus(bool breaktime)
 {
     if (breaktime)
+    {
 	reportStatusExtended(SIGTRAP);
+	if (watchHit != NULL)
+	{
+	    int len = strlen(remcomOutBuffer);
+
+	    snprintf(remcomOutBuffer + len, sizeof(remcomOutBuffer) - len,
+		     "%s:%x;", watchHit->type == ACCESS_DATA? "awatch": "watch",
+		     watchHit->addr);
+	    watchHit = NULL;
+	}
+    }
     else
     {
 	// A breakpoint did not occur. Assume that GDB sent a break.
@@ -658,6 +1467,41 @@ static void repStatus(bool breaktime)
 	// Report this as a user interrupt
 	reportStatusExtended(SIGINT);
     }
+
+    if (brokerMode)
+    {
+	snprintf(stopReply, sizeof stopReply, "Stop:%s", remcomOutBuffer);
+	stopPending = true;
+    }
+}
+
+/** True if a client that does not control the target may send packet
+    'cmd' ('ptr' is the rest): the packets that only inspect the target.
+**/
+static bool observerPacket(char cmd, const char *ptr)
+{
+    switch (cmd)
+    {
+    case '?':
+    case 'g':
+    case 'p':
+    case 'm':
+    case 'x':
+    case 'H':
+    case 'T':
+    case 'k':
+    case '!':
+	return true;
+    case 'q':
+	return strncmp(ptr, "Rcmd,", 5) != 0;
+    case 'Q':
+	return strncmp(ptr, "StartNoAckMode", 14) == 0 ||
+	    strncmp(ptr, "avarice.StopNotify:", 19) == 0;
+    case 'v':
+	return strncmp(ptr, "Cont?", 5) == 0 || strncmp(ptr, "Stopped", 7) == 0;
+    default:
+	return false;
+    }
 }
 
 static char *makeSafeString(const char *s, int inLength)
@@ -690,17 +1534,16 @@ void talkToGdb(void)
     int addr;
     int length, plen;
     int i;
-    unsigned int newPC;
     int regno;
-    char *ptr;
+    char *ptr, *pktend;
     bool adding = false;
     bool dontSendReply = false;
+    bool startNoAck = false;
     char cmd;
     static char last_cmd = 0;
-    static unsigned char *flashbuf;
-    static int maxaddr;
 
     ptr = getpacket(plen);
+    pktend = ptr + plen;
 
     if (debugMode)
       {
@@ -713,6 +1556,15 @@ void talkToGdb(void)
     remcomOutBuffer[0] = 0;
 
     cmd = *ptr++;
+    if (brokerMode && currentGdbClient != 0 && !observerPacket(cmd, ptr))
+    {
+	// only the controlling client may change the target
+	debugOut("client %d does not control the target\n", currentGdbClient);
+	error(1);
+	putpacket(remcomOutBuffer);
+	return;
+    }
+
     switch (cmd)
     {
     default:	// Unknown code.  Return an empty reply message.
@@ -738,6 +1590,7 @@ void talkToGdb(void)
 	ok();
 	break;
 
+    case 'X':
     case 'M':
     {
 	uchar *jtagBuffer;
@@ -746,14 +1599,23 @@ void talkToGdb(void)
         static uchar last_orphan = 0xff;
 
 	// MAA..AA,LLLL: Write LLLL bytes at address AA.AA return OK
+	// XAA..AA,LLLL: Same, but the data are sent in binary
 	// TRY TO READ '%x,%x:'.  IF SUCCEED, SET PTR = 0
 
 	error(1); // default is error
-	if((hexToInt(&ptr, &addr)) &&
-	   (*(ptr++) == ',') &&
-	   (hexToInt(&ptr, &length)) &&
-	   (*(ptr++) == ':') &&
-	   (length > 0))
+	if(!((hexToInt(&ptr, &addr)) &&
+	     (*(ptr++) == ',') &&
+	     (hexToInt(&ptr, &length)) &&
+	     (*(ptr++) == ':')))
+	    break;
+
+	if (length == 0 && cmd == 'X')
+	{
+	    // gdb probes for X packet support this way
+	    ok();
+	}
+	else if (length > 0 &&
+		 (cmd == 'M' || ptr + length <= pktend))
 	{
 	    debugOut("\nGDB: Write %d bytes to 0x%X\n",
 		      length, addr);
@@ -767,7 +1629,8 @@ void talkToGdb(void)
             if (addr & 1)
             {
                 // odd addr means there may be a byte from last 'M' to write
-                if ((last_cmd == 'M') && (last_orphan_pending))
+                if ((last_cmd == 'M' || last_cmd == 'X') &&
+                    last_orphan_pending)
                 {
                     length++;
                     addr--;
@@ -778,7 +1641,10 @@ void talkToGdb(void)
             last_orphan_pending = false;
 
 	    jtagBuffer = new uchar[length];
-	    hex2mem(ptr, jtagBuffer+lead, length);
+	    if (cmd == 'X')
+		memcpy(jtagBuffer+lead, ptr, length - lead);
+	    else
+		hex2mem(ptr, jtagBuffer+lead, length - lead);
             if (lead)
                 jtagBuffer[0] = last_orphan;
 
@@ -787,13 +1653,14 @@ void talkToGdb(void)
                 // An odd length means we will have an orphan this round but
                 // only if we are writing to PROG space.
                 last_orphan_pending = true;
-                last_orphan = jtagBuffer[length];
+                last_orphan = jtagBuffer[length - 1];
                 length--;
             }
 
 	    try
             {
-                theJtagICE->jtagWrite(addr, length, jtagBuffer);
+                theJtagICE->memoryWrite(addr, length, jtagBuffer);
+                theJtagICE->registerFileWrite(addr, length);
             }
             catch (jtag_exception&)
             {
@@ -808,19 +1675,39 @@ void talkToGdb(void)
 	break;
     }
     case 'm':	// mAA..AA,LLLL  Read LLLL bytes at address AA..AA
+    case 'x':	// xAA..AA,LLLL  Same, reply in binary
     {
-	uchar *jtagBuffer;
+	uchar jtagBuffer[BUFMAX / 2];
 
 	if((hexToInt(&ptr, &addr)) &&
 	   (*(ptr++) == ',') &&
 	   (hexToInt(&ptr, &length)))
 	{
+	    // Never reply with more than fits into our packet size
+	    // (escaping may double the size of binary data).
+	    if (length > (packetSize() - 1) / 2)
+		length = (packetSize() - 1) / 2;
+
 	    debugOut("\nGDB: Read %d bytes from 0x%X\n", length, addr);
 	    try
 	    {
-		jtagBuffer = theJtagICE->jtagRead(addr, length);
-		mem2hex(jtagBuffer, remcomOutBuffer, length);
-		delete [] jtagBuffer;
+		// Data memory of a trace frame comes from the trace
+		// buffer, flash from the target.
+		if (traceFrameSelected() && (addr & ADDR_SPACE_MASK) != 0)
+		{
+		    length = traceFrameMemory(addr, length, jtagBuffer);
+		    if (length == 0)
+			throw jtag_exception("not collected");
+		}
+		else
+		    theJtagICE->memoryRead(addr, length, jtagBuffer);
+		if (cmd == 'x')
+		{
+		    remcomOutBuffer[0] = 'b';
+		    mem2bin(jtagBuffer, remcomOutBuffer + 1, length);
+		}
+		else
+		    mem2hex(jtagBuffer, remcomOutBuffer, length);
 	    }
 	    catch (jtag_exception&)
 	    {
@@ -836,72 +1723,24 @@ void talkToGdb(void)
 
     case 'g':   // return the value of the CPU registers
     {
-	uchar *jtagBuffer;
-        uchar regBuffer[40];
-
-        memset(regBuffer, 0, sizeof(regBuffer));
-
-	// Read the registers directly from memory
-	// R0..R31 are at locations 0..31
-	// SP is at 0x5D & 0x5E
-	// SREG is at 0x5F
-	debugOut("\nGDB: (Registers)Read %d bytes from 0x%X\n",
-		  0x20, theJtagICE->cpuRegisterAreaAddress());
-	jtagBuffer = theJtagICE->jtagRead(theJtagICE->cpuRegisterAreaAddress(), 0x20);
+        uchar regBuffer[NUMREGBYTES];
 
-	if (jtagBuffer)
-	{
-            // Put GPRs into the first 32 locations
-            memcpy(regBuffer, jtagBuffer, 0x20);
-
-            delete [] jtagBuffer;
-            jtagBuffer = 0;
-        }
-        else
+        if (traceFrameSelected())
         {
-            error (1);
-            break;
-        }
-
-        // Read in SPL SPH SREG
-        jtagBuffer = theJtagICE->jtagRead(theJtagICE->statusAreaAddress(), 0x03);
-     
-        if (jtagBuffer)
-        {
-            // We have SPL SPH SREG and need SREG SPL SPH
-
-            // SREG
-            regBuffer[0x20] = jtagBuffer[0x02];
-
-            // NOTE: Little endian, so SPL comes first.
-
-            // SPL
-            regBuffer[0x21] = jtagBuffer[0x00];
-
-            // SPH
-            regBuffer[0x22] = jtagBuffer[0x01];
-
-            delete [] jtagBuffer;
-            jtagBuffer = 0;
+            if (traceFrameRegisters(regBuffer))
+                mem2hex(regBuffer, remcomOutBuffer, NUMREGBYTES);
+            else
+            {
+                // only the PC is known, the others are "unavailable"
+                memset(remcomOutBuffer, 'x', 2 * REGFILE_PC);
+                mem2hex(regBuffer + REGFILE_PC, remcomOutBuffer + 2 * REGFILE_PC,
+                        NUMREGBYTES - REGFILE_PC);
+            }
         }
+        else if (theJtagICE->readRegisterFile(regBuffer))
+            mem2hex(regBuffer, remcomOutBuffer, NUMREGBYTES);
         else
-        {
-            error (1);
-            break;
-        }
-
-        // PC
-        newPC = theJtagICE->getProgramCounter();
-        regBuffer[35] = (unsigned char)(newPC & 0xff);
-        regBuffer[36] = (unsigned char)((newPC & 0xff00) >> 8);
-        regBuffer[37] = (unsigned char)((newPC & 0xff0000) >> 16);
-        regBuffer[38] = (unsigned char)((newPC & 0xff000000) >> 24);
-        debugOut("PC = %x\n", newPC);
-
-        if (newPC == PC_INVALID)
             error(1);
-        else
-            mem2hex(regBuffer, remcomOutBuffer, 32 + 1 + 2 + 4);
 
 	break;
     }
@@ -1024,7 +1863,11 @@ void talkToGdb(void)
         }
 	else if (strncmp(ptr, "Supported:", 10) == 0)
 	{
-	    strcpy(remcomOutBuffer, "qXfer:memory-map:read+");
+	    sprintf(remcomOutBuffer,
+		    "PacketSize=%x;qXfer:memory-map:read+;QStartNoAckMode+;"
+		    "ConditionalBreakpoints+;ConditionalTracepoints+;"
+		    "EnableDisableTracepoints+;tracenz+",
+		    packetSize());
 	}
 	else if (strncmp(ptr, "Xfer:memory-map:read::", 22) == 0)
 	{
@@ -1044,14 +1887,37 @@ void talkToGdb(void)
 		  theJtagICE->deviceDef->flash_page_count,
 		  theJtagICE->deviceDef->flash_page_size);
 	}
-        else if (length > 5 && strncmp(ptr, "Rcmd,", 4) == 0)
+	else if (strncmp(ptr, "CRC:", 4) == 0)
+	{
+	    // qCRC:AA..AA,LLLL  CRC of LLLL bytes at AA..AA, for
+	    // compare-sections
+	    ptr += 4;
+	    if (hexToInt(&ptr, &addr) && *ptr++ == ',' &&
+		hexToInt(&ptr, &length))
+	    {
+		debugOut("\nGDB: CRC of %d bytes at 0x%X\n", length, addr);
+		try
+		{
+		    sprintf(remcomOutBuffer, "C%x", memoryCrc(addr, length));
+		}
+		catch (jtag_exception&)
+		{
+		    error(1);
+		}
+	    }
+	    else
+		error(1);
+	}
+	else if (traceCommand(cmd, ptr, remcomOutBuffer))
+	    ;	// tracepoint query
+        else if (strncmp(ptr, "Rcmd,", 5) == 0)
         {
             char cmdbuf[MONMAX];
             int i;
             ptr += 5;
-            length -= 5;
+            length = strlen(ptr);
             memset(cmdbuf, 0, sizeof cmdbuf);
-            for (i = 0; i < MONMAX && length >= 0; i++)
+            for (i = 0; i < MONMAX - 1 && length > 0; i++)
             {
                 int c;
                 length -= hexToInt(&ptr, &c, 2);
@@ -1068,6 +1934,25 @@ void talkToGdb(void)
         break;
     }
 
+    case 'Q':   // general set
+        if (strcmp(ptr, "StartNoAckMode") == 0)
+        {
+            // The OK reply is still acknowledged, stop afterwards.
+            startNoAck = true;
+            ok();
+        }
+        else if (strncmp(ptr, "avarice.StopNotify:", 19) == 0)
+        {
+            if (brokerMode)
+            {
+                gdbClients[currentGdbClient].stopNotify = ptr[19] == '1';
+                ok();
+            }
+        }
+        else
+            traceCommand(cmd, ptr, remcomOutBuffer);
+        break;
+
     case 'P':   // set the value of a single CPU register - return OK
 	error(1); // error by default
 	if (hexToInt(&ptr, &regno) && *ptr++ == '=')
@@ -1076,32 +1961,22 @@ void talkToGdb(void)
 
             try
             {
-                if (regno >= 0 && regno < NUMREGS)
+                if ((regno >= 0 && regno < NUMREGS) || regno == SREG)
                 {
                     hex2mem(ptr, reg, 1);
-                    theJtagICE->jtagWrite(theJtagICE->cpuRegisterAreaAddress() + regno,
-                                          1, reg);
+                    theJtagICE->writeRegisterFile(regno, 1, reg);
                     ok();
-                    break;
-                }
-                else if (regno == SREG)
-                {
-                    hex2mem(ptr, reg, 1);
-                    theJtagICE->jtagWrite(theJtagICE->statusAreaAddress() + 2,
-					  1, reg);
                 }
                 else if (regno == SP)
                 {
                     hex2mem(ptr, reg, 2);
-                    theJtagICE->jtagWrite(theJtagICE->statusAreaAddress(),
-                                          2, reg);
+                    theJtagICE->writeRegisterFile(REGFILE_SP, 2, reg);
                     ok();
                 }
                 else if (regno == PC)
                 {
                     hex2mem(ptr, reg, 4);
-                    theJtagICE->setProgramCounter(reg[0] | reg[1] << 8 |
-                                                  reg[2] << 16 | reg[3] << 24);
+                    theJtagICE->writeRegisterFile(REGFILE_PC, 4, reg);
                     ok();
                 }
             }
@@ -1180,26 +2055,49 @@ void talkToGdb(void)
 		gdbOut("Failed to set PC");
             }
 	}
-	repStatus(theJtagICE->jtagContinue());
+	repStatus(continueProgram());
 	break;
 
     case 'D':
         // Detach, resumes target. Can get control back with step
 	// or continue
-        try
-        {
-            theJtagICE->resumeProgram();
-        }
-        catch (jtag_exception&)
-        {
-	    error(1);
-            break;
-        }
-        ok();
+        if (endGdbSession())
+            ok();
+        else
+            error(1);
 	break;
 
     case 'v':
-        if (strncmp(ptr, "FlashErase:", 11) == 0)
+        if (strncmp(ptr, "Cont?", 5) == 0)
+	    strcpy(remcomOutBuffer, "vCont;c;C;s;S;r");
+        else if (strncmp(ptr, "Stopped", 7) == 0)
+	    ok();		// no more stop notifications queued
+        else if (strncmp(ptr, "Cont;", 5) == 0)
+	{
+	    // vCont;ACTION[:THREAD]...  There is only one thread, so
+	    // the first action applies.  Signals are ignored.
+	    ptr += 5;
+	    char action = *ptr++;
+	    int sig, start, end;
+
+	    if (action == 'C' || action == 'S')
+		hexToInt(&ptr, &sig);
+
+	    if (action == 'c' || action == 'C')
+		repStatus(continueProgram());
+	    else if (action == 's' || action == 'S')
+		repStatus(singleStep());
+	    else if (action == 'r')
+	    {
+		if (hexToInt(&ptr, &start) && *ptr++ == ',' &&
+		    hexToInt(&ptr, &end))
+		    repStatus(rangeStep(start, end));
+		else
+		    error(1);
+	    }
+	    // else: unsupported action, empty reply
+	}
+        else if (strncmp(ptr, "FlashErase:", 11) == 0)
 	{
 	    ptr += 11;
 	    int offset, length;
@@ -1207,14 +2105,15 @@ void talkToGdb(void)
 	    ptr++;
 	    hexToInt(&ptr, &length);
 	    statusOut("erasing %d bytes @ 0x%0x\n", length, offset);
-	    theJtagICE->enableProgramming();
-	    theJtagICE->eraseProgramMemory();
-	    flashbuf = new unsigned char[theJtagICE->deviceDef->flash_page_size *
-					 theJtagICE->deviceDef->flash_page_count];
-	    maxaddr = 0;
-	    memset(flashbuf, 0xff, theJtagICE->deviceDef->flash_page_size *
-		   theJtagICE->deviceDef->flash_page_count);
-	    ok();
+	    try
+	    {
+		flashStart();
+		ok();
+	    }
+	    catch (jtag_exception& e)
+	    {
+		error(1);
+	    }
 	}
 	else if (strncmp(ptr, "FlashWrite:", 11) == 0)
 	{
@@ -1224,23 +2123,19 @@ void talkToGdb(void)
 	    hexToInt(&ptr, &offset);
 	    ptr++;		// past ":"
 	    int amount = plen - 1 - (ptr - optr);
-	    statusOut("buffering data, %d bytes @ 0x%x\n", amount, offset);
-	    if (offset + amount > maxaddr)
-		maxaddr = offset + amount;
-	    memcpy(flashbuf + offset, ptr, amount);
-	    ok();
+	    debugOut("buffering data, %d bytes @ 0x%x\n", amount, offset);
+	    if (flashWrite(offset, amount, (uchar *)ptr))
+		ok();
+	    else
+		error(1);
 	}
 	else if (strncmp(ptr, "FlashDone", 9) == 0)
 	{
 	    statusOut("committing to flash\n");
-	    int pagesize = theJtagICE->deviceDef->flash_page_size;
-	    for (int offset = 0; offset < maxaddr; offset += pagesize)
-	    {
-		theJtagICE->jtagWrite(offset, pagesize, flashbuf + offset);
-	    }
-	    theJtagICE->disableProgramming();
-	    delete [] flashbuf;
-	    ok();
+	    if (flashDone())
+		ok();
+	    else
+		error(1);
 	}
 	break;
 
@@ -1278,25 +2173,44 @@ void talkToGdb(void)
 
 	    if (adding)
 	    {
+		bool added;
+
 		try
                 {
-                    theJtagICE->addBreakpoint(addr, mode, length);
+		    // tracing may hold a breakpoint here already
+		    if (mode == CODE && traceShareBreakpoint(addr, true))
+			added = true;
+		    else
+			added = theJtagICE->addBreakpoint(addr, mode, length);
                 }
                 catch (jtag_exception&)
                 {
                     break;
                 }
+		if (mode == CODE && !parseConditions(ptr, addr))
+		    break;
+		// no room in the ICE: emulate the watchpoint
+		if (mode != CODE && !addWatchpoint(addr, mode, length, added))
+		    break;
 	    }
 	    else
 	    {
+		if (mode != CODE && !deleteWatchpoint(addr, mode))
+		{
+		    ok();
+		    break;
+		}
 		try
                 {
-                    theJtagICE->deleteBreakpoint(addr, mode, length);
+		    if (mode != CODE || !traceShareBreakpoint(addr, false))
+			theJtagICE->deleteBreakpoint(addr, mode, length);
                 }
                 catch (jtag_exception&)
                 {
                     break;
                 }
+		if (mode == CODE)
+		    clearConditions(addr);
 	    }
             ok();
 	}
@@ -1309,9 +2223,215 @@ void talkToGdb(void)
     // reply to the request
     if (!dontSendReply)
     {
-        debugOut("->GDB: %s\n", remcomOutBuffer);
+        if (debugMode)
+        {
+            char *s = makeSafeString(remcomOutBuffer, strlen(remcomOutBuffer));
+            debugOut("->GDB: %s\n", s);
+            delete [] s;
+        }
 	putpacket(remcomOutBuffer);
     }
+
+    // Program the flash pages gdb has finished with while it is busy
+    // sending the next chunk.
+    flashCommit(flashLoad.end & ~(flashLoad.pageSize - 1));
+
+    if (startNoAck)
+    {
+        debugOut("Entering no-ack mode\n");
+        noAckMode = true;
+    }
+}
+
+/** Save the connection state of the current broker client **/
+static void parkGdbClient(void)
+{
+    if (currentGdbClient < 0)
+	return;
+
+    gdbClient *c = &gdbClients[currentGdbClient];
+
+    c->inputLen = gdbInTail - gdbInHead;
+    memcpy(c->input, gdbInBuffer + gdbInHead, c->inputLen);
+    c->noAckMode = noAckMode;
+    c->stats = gdbIoStats;
+    currentGdbClient = -1;
+}
+
+/** Make broker client 'n' the current one **/
+static void switchGdbClient(int n)
+{
+    if (n == currentGdbClient)
+	return;
+
+    parkGdbClient();
+
+    gdbClient *c = &gdbClients[n];
+
+    gdbFileDescriptor = gdbOutputDescriptor = c->fd;
+    memcpy(gdbInBuffer, c->input, c->inputLen);
+    gdbInHead = 0;
+    gdbInTail = c->inputLen;
+    noAckMode = c->noAckMode;
+    gdbIoStats = c->stats;
+    currentGdbClient = n;
+}
+
+/** True if input of broker client 'n' was read already **/
+static bool gdbClientBuffered(int n)
+{
+    if (n == currentGdbClient)
+	return gdbInputPending();
+
+    return gdbClients[n].inputLen > 0;
+}
+
+static void acceptGdbClient(int sock)
+{
+    int fd = acceptGdbConnection(sock);
+
+    if (fd < 0)
+    {
+	debugOut("accept failed: %s\n", strerror(errno));
+	return;
+    }
+    if (numGdbClients == MAX_GDB_CLIENTS)
+    {
+	statusOut("Too many clients, connection refused.\n");
+	close(fd);
+	return;
+    }
+
+    parkGdbClient();
+    currentGdbClient = numGdbClients++;
+    gdbClients[currentGdbClient].fd = fd;
+    gdbClients[currentGdbClient].stopNotify = false;
+    setGdbFile(fd);
+    if (currentGdbClient > 0)
+	statusOut("Client %d can inspect the target, client 0 controls it.\n",
+		  currentGdbClient);
+}
+
+/** Forget the current broker client, whose connection was closed **/
+static void removeGdbClient(void)
+{
+    int n = currentGdbClient;
+
+    close(gdbClients[n].fd);
+    numGdbClients--;
+    memmove(&gdbClients[n], &gdbClients[n + 1],
+	    (numGdbClients - n) * sizeof *gdbClients);
+    currentGdbClient = -1;
+    gdbFileDescriptor = gdbOutputDescriptor = -1;
+    gdbExited = false;
+
+    if (n == 0 && numGdbClients > 0)
+	statusOut("The next client now controls the target.\n");
+}
+
+/** Send the pending stop notification to all clients but 'from' **/
+static void notifyGdbClients(int from)
+{
+    stopPending = false;
+
+    // backwards, removing a client only moves those done already
+    for (int i = numGdbClients - 1; i >= 0; i--)
+    {
+	if (i == from || !gdbClients[i].stopNotify)
+	    continue;
+
+	switchGdbClient(i);
+	try
+	{
+	    debugOut("->client %d: %%%s\n", i, stopReply);
+	    putnotification(stopReply);
+	}
+	catch (jtag_exception&)
+	{
+	    if (!gdbExited)
+		throw;
+	    removeGdbClient();
+	}
+    }
+}
+
+/** Handle a packet from broker client 'n' **/
+static void serveGdbClient(int n)
+{
+    switchGdbClient(n);
+    try
+    {
+	// skip acks and stray characters, they need no reply
+	for (;;)
+	{
+	    if (!gdbInputPending() && !fillDebugInput(false))
+		return;
+	    if (gdbInBuffer[gdbInHead] == '$')
+		break;
+	    gdbInHead++;
+	}
+
+	talkToGdb();
+    }
+    catch (jtag_exception&)
+    {
+	if (!gdbExited)
+	    throw;
+	removeGdbClient();
+	return;
+    }
+
+    if (stopPending)
+	notifyGdbClients(n);
 }
 
+void serveGdbClients(int sock)
+{
+    int next = 0;		// round robin among the clients
+
+    brokerMode = true;
+
+    acceptGdbClient(sock);
+    while (numGdbClients > 0)
+    {
+	fd_set readfds;
+	int maxfd = sock;
+	bool buffered = false;
+
+	FD_ZERO(&readfds);
+	FD_SET(sock, &readfds);
+	for (int i = 0; i < numGdbClients; i++)
+	{
+	    FD_SET(gdbClients[i].fd, &readfds);
+	    if (gdbClients[i].fd > maxfd)
+		maxfd = gdbClients[i].fd;
+	    if (gdbClientBuffered(i))
+		buffered = true;
+	}
+
+	// don't wait if there is input we read already
+	struct timeval poll = { 0, 0 };
+	if (select(maxfd + 1, &readfds, 0, 0, buffered? &poll: 0) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    throw jtag_exception();
+	}
+
+	if (FD_ISSET(sock, &readfds))
+	    acceptGdbClient(sock);
 
+	// one packet per round, so that commands are serialized
+	for (int k = 0; k < numGdbClients; k++)
+	{
+	    int i = (next + k) % numGdbClients;
+
+	    if (gdbClientBuffered(i) || FD_ISSET(gdbClients[i].fd, &readfds))
+	    {
+		next = i + 1;
+		serveGdbClient(i);
+		break;
+	    }
+	}
+    }
+}
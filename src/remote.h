@@ -25,13 +25,31 @@
 /** File descriptor for gdb communication. -1 before connection. **/
 extern int gdbFileDescriptor;
 
-/** Talk to gdb over file descriptor 'fd' **/
-void setGdbFile(int fd);
+/** Set when gdb closed the connection; the jtag_exception thrown then
+    ends the session, not the server. **/
+extern bool gdbExited;
+
+/** Accept a gdb connection on the listening (TCP or Unix domain)
+    socket 'sock'.  Return the connection, or -1 on failure. **/
+int acceptGdbConnection(int sock);
+
+/** Talk to gdb over file descriptor 'fd', or read from 'fd' and write
+    to 'outFd' if that is given (stdio mode).  If the previous session
+    ended with gdb disconnecting, the target is halted again. **/
+void setGdbFile(int fd, int outFd = -1);
 
 /** Return single char read from gdb. Abort in case of problem,
     exit cleanly if EOF detected on gdbFileDescriptor. **/
 int getDebugChar(void);
 
+/** Return a char read from gdb if one is available without
+    blocking, -1 otherwise. **/
+int checkForDebugChar(void);
+
+/** True if input from gdb has already been read from the socket but
+    not yet consumed; select() on gdbFileDescriptor will not see it. **/
+bool gdbInputPending(void);
+
 /** printf 'fmt, ...' to gdb **/
 void gdbOut(const char *fmt, ...);
 void vgdbOut(const char *fmt, va_list args);
@@ -39,4 +57,12 @@ void vgdbOut(const char *fmt, va_list args);
 /** GDB remote protocol interpreter */
 void talkToGdb(void);
 
+/** Broker mode: serve several remote protocol clients connecting to
+    the listening socket 'sock', one packet at a time.  The first client
+    controls the target, the others may only inspect it, and are sent a
+    stop notification whenever the target stops.  When the controlling
+    client disconnects, the next one takes over.  Returns when the last
+    client disconnected. **/
+void serveGdbClients(int sock);
+
 #endif /* INCLUDE_REMOTE_H */
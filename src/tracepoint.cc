@@ -0,0 +1,821 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file implements tracepoints (see "Tracepoints" in the gdb
+ * manual).  While tracing runs, each tracepoint is a code breakpoint.
+ * Tracing holds its own reference on these breakpoints, so gdb can
+ * set and delete a breakpoint at the same address meanwhile; the ICE
+ * breakpoint goes away once neither needs it any more.
+ * When the target hits one, the registers and memory requested by
+ * the tracepoint's actions are appended to the trace buffer as a
+ * trace frame, and the target is resumed without involving gdb.
+ * Afterwards, gdb selects frames with QTFrame ("tfind"), and reads
+ * them through the usual 'g' and 'm' packets.
+ *
+ * The trace buffer is a sequence of frames.  Each frame starts with
+ * the tracepoint number and the frame size (2 bytes each, little
+ * endian), followed by blocks:
+ *
+ *   'R' <register file, REGFILE_SIZE bytes>
+ *   'M' <address, 4 bytes> <length, 2 bytes> <data>
+ *
+ * While-stepping actions and trace state variables are not supported.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avarice.h"
+#include "jtag.h"
+#include "agentexpr.h"
+#include "tracepoint.h"
+
+enum {
+    MAX_TRACEPOINTS	= 32,
+    MAX_TRACE_ACTIONS	= 16,
+    TRACE_BUFSIZE	= 64 * 1024,
+    TRACE_FRAMEHDR	= 4,
+    TRACE_MAX_MEMBLOCK	= 1024,
+};
+
+enum traceStop {
+    TRACE_NOTRUN,		// tracing has never been started
+    TRACE_STOPPED,		// QTStop
+    TRACE_FULL,			// trace buffer full
+    TRACE_PASSCOUNT,		// a tracepoint reached its pass count
+};
+
+struct traceAction
+{
+    char type;			// 'R', 'M' or 'X'
+    int basereg;		// 'M': -1 for an absolute address
+    unsigned long offset;	// 'M'
+    unsigned int length;	// 'M' and 'X'
+    uchar *code;		// 'X'
+};
+
+struct tracepoint
+{
+    unsigned int num;
+    unsigned long addr;
+    bool enabled;
+    unsigned int passCount;	// 0: unlimited
+    unsigned int hits;
+    uchar *cond;
+    unsigned int condLength;
+    int numActions;
+    traceAction actions[MAX_TRACE_ACTIONS];
+};
+
+static tracepoint tracepoints[MAX_TRACEPOINTS];
+static int numTracepoints;
+
+/** A code breakpoint held by tracing.  There is one per address, no
+    matter how many tracepoints share it. **/
+struct traceBreakpoint
+{
+    unsigned long addr;
+    bool gdbHolds;		// gdb has a breakpoint here as well
+};
+
+static traceBreakpoint traceBreakpoints[MAX_TRACEPOINTS];
+static int numTraceBreakpoints;
+
+static bool traceRunning;
+static traceStop stopReason = TRACE_NOTRUN;
+static unsigned int stopTracepoint;
+
+static uchar traceBuffer[TRACE_BUFSIZE];
+static unsigned int traceUsed;		// bytes of complete frames
+static unsigned int traceFrames;	// number of complete frames
+static unsigned int frameUsed;		// bytes of the frame being collected
+static bool frameOverflow;
+
+static int currentFrame = -1;		// selected by QTFrame
+static unsigned int currentFrameOffset;
+
+static void freeTracepoint(tracepoint *tp)
+{
+    delete [] tp->cond;
+    for (int i = 0; i < tp->numActions; i++)
+	delete [] tp->actions[i].code;
+    memset(tp, 0, sizeof *tp);
+}
+
+static tracepoint *findTracepoint(unsigned int num, unsigned long addr)
+{
+    for (int i = 0; i < numTracepoints; i++)
+	if (tracepoints[i].num == num && tracepoints[i].addr == addr)
+	    return &tracepoints[i];
+    return NULL;
+}
+
+/** Parse "<len>,<hex bytes>" at 'ptr' into a newly allocated buffer **/
+static uchar *parseBytecode(char *&ptr, unsigned int &length)
+{
+    length = strtoul(ptr, &ptr, 16);
+    if (*ptr++ != ',' || length == 0 || strlen(ptr) < 2 * length)
+	return NULL;
+
+    uchar *code = new uchar[length];
+    for (unsigned int i = 0; i < length; i++, ptr += 2)
+    {
+	char hexbyte[3] = { ptr[0], ptr[1], 0 };
+	code[i] = strtoul(hexbyte, NULL, 16);
+    }
+
+    return code;
+}
+
+static traceBreakpoint *findTraceBreakpoint(unsigned long addr)
+{
+    for (int i = 0; i < numTraceBreakpoints; i++)
+	if (traceBreakpoints[i].addr == addr)
+	    return &traceBreakpoints[i];
+    return NULL;
+}
+
+/** Take tracing's reference on the code breakpoint at 'addr'.  A
+    breakpoint gdb set already is shared, and stays when tracing
+    releases it.
+**/
+static void holdBreakpoint(unsigned long addr)
+{
+    if (findTraceBreakpoint(addr) != NULL)
+	return;
+
+    traceBreakpoint *tb = &traceBreakpoints[numTraceBreakpoints];
+    tb->addr = addr;
+    tb->gdbHolds = theJtagICE->codeBreakpointAt(addr);
+    if (!tb->gdbHolds && !theJtagICE->addBreakpoint(addr, CODE, 0))
+	throw jtag_exception("no breakpoint available");
+    numTraceBreakpoints++;
+}
+
+/** Drop tracing's reference on the code breakpoint at 'addr' **/
+static void releaseBreakpoint(unsigned long addr)
+{
+    traceBreakpoint *tb = findTraceBreakpoint(addr);
+
+    if (tb == NULL)
+	return;
+
+    bool gdbHolds = tb->gdbHolds;
+    *tb = traceBreakpoints[--numTraceBreakpoints];
+    if (!gdbHolds)
+	theJtagICE->deleteBreakpoint(addr, CODE, 0);
+}
+
+static void stopTracing(traceStop reason, unsigned int tpnum = 0)
+{
+    if (!traceRunning)
+	return;
+
+    traceRunning = false;
+    stopReason = reason;
+    stopTracepoint = tpnum;
+
+    while (numTraceBreakpoints > 0)
+    {
+	try
+	{
+	    releaseBreakpoint(traceBreakpoints[0].addr);
+	}
+	catch (jtag_exception&)
+	{
+	}
+    }
+
+    debugOut("tracing stopped, %u frames, %u bytes\n", traceFrames, traceUsed);
+}
+
+static bool startTracing(void)
+{
+    traceUsed = traceFrames = 0;
+    currentFrame = -1;
+    traceRunning = true;
+
+    for (int i = 0; i < numTracepoints; i++)
+    {
+	tracepoint *tp = &tracepoints[i];
+
+	tp->hits = 0;
+	if (!tp->enabled)
+	    continue;
+
+	try
+	{
+	    holdBreakpoint(tp->addr);
+	}
+	catch (jtag_exception& e)
+	{
+	    fprintf(stderr, "Cannot set tracepoint %u at 0x%lx: %s\n",
+		    tp->num, tp->addr, e.what());
+	    stopTracing(TRACE_STOPPED);
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+/** Enable or disable 'tp'.  While tracing runs, this takes effect
+    right away. **/
+static bool enableTracepoint(tracepoint *tp, bool enable)
+{
+    tp->enabled = enable;
+    if (!traceRunning)
+	return true;
+
+    try
+    {
+	if (enable)
+	    holdBreakpoint(tp->addr);
+	else
+	{
+	    // other tracepoints at this address may still need it
+	    for (int i = 0; i < numTracepoints; i++)
+		if (tracepoints[i].enabled && tracepoints[i].addr == tp->addr)
+		    return true;
+	    releaseBreakpoint(tp->addr);
+	}
+    }
+    catch (jtag_exception& e)
+    {
+	fprintf(stderr, "Cannot %s tracepoint %u at 0x%lx: %s\n",
+		enable? "enable": "disable", tp->num, tp->addr, e.what());
+	tp->enabled = !enable;
+	return false;
+    }
+
+    return true;
+}
+
+/** Append 'length' bytes to the frame being collected **/
+static void frameAppend(const uchar *data, unsigned int length)
+{
+    if (traceUsed + frameUsed + length > TRACE_BUFSIZE ||
+	frameUsed + length > 0xffff)
+    {
+	frameOverflow = true;
+	return;
+    }
+
+    memcpy(traceBuffer + traceUsed + frameUsed, data, length);
+    frameUsed += length;
+}
+
+static void collectMemory(unsigned long addr, unsigned int numBytes)
+{
+    uchar hdr[7];
+    uchar buf[TRACE_MAX_MEMBLOCK];
+
+    if (numBytes > TRACE_MAX_MEMBLOCK)
+	numBytes = TRACE_MAX_MEMBLOCK;
+
+    try
+    {
+	theJtagICE->memoryRead(addr, numBytes, buf);
+    }
+    catch (jtag_exception& e)
+    {
+	debugOut("trace: cannot collect 0x%lx: %s\n", addr, e.what());
+	return;
+    }
+
+    hdr[0] = 'M';
+    hdr[1] = addr;
+    hdr[2] = addr >> 8;
+    hdr[3] = addr >> 16;
+    hdr[4] = addr >> 24;
+    hdr[5] = numBytes;
+    hdr[6] = numBytes >> 8;
+    frameAppend(hdr, sizeof hdr);
+    frameAppend(buf, numBytes);
+}
+
+static void collectRegisters(void)
+{
+    uchar block[1 + REGFILE_SIZE];
+
+    block[0] = 'R';
+    if (theJtagICE->readRegisterFile(block + 1))
+	frameAppend(block, sizeof block);
+}
+
+/** Collect one trace frame for 'tp'.  Return false if the trace
+    buffer is full. **/
+static bool collectFrame(tracepoint *tp)
+{
+    uchar hdr[TRACE_FRAMEHDR] = { 0 };
+
+    frameUsed = 0;
+    frameOverflow = false;
+    frameAppend(hdr, sizeof hdr);
+
+    for (int i = 0; i < tp->numActions; i++)
+    {
+	traceAction *a = &tp->actions[i];
+
+	switch (a->type)
+	{
+	case 'R':
+	    collectRegisters();
+	    break;
+
+	case 'M':
+	{
+	    unsigned long addr = a->offset;
+
+	    if (a->basereg != -1)
+	    {
+		uchar regs[REGFILE_SIZE];
+		unsigned int base;
+
+		if (!theJtagICE->readRegisterFile(regs))
+		    break;
+		if (a->basereg >= 26 && a->basereg < 32 && !(a->basereg & 1))
+		    // X, Y, Z pointer register pairs
+		    base = regs[a->basereg] | (regs[a->basereg + 1] << 8);
+		else if (a->basereg == 33)
+		    base = regs[REGFILE_SP] | (regs[REGFILE_SP + 1] << 8);
+		else if (a->basereg >= 0 && a->basereg < 32)
+		    base = regs[a->basereg];
+		else
+		    break;
+		addr = ((base + addr) & 0xffff) | DATA_SPACE_ADDR_OFFSET;
+	    }
+	    collectMemory(addr, a->length);
+	    break;
+	}
+
+	case 'X':
+	{
+	    long long result;
+
+	    if (!axEvaluate(a->code, a->length, result, collectMemory))
+		debugOut("trace: expression of tracepoint %u failed\n",
+			 tp->num);
+	    break;
+	}
+	}
+    }
+
+    if (frameOverflow)
+	return false;
+
+    hdr[0] = tp->num;
+    hdr[1] = tp->num >> 8;
+    hdr[2] = frameUsed - TRACE_FRAMEHDR;
+    hdr[3] = (frameUsed - TRACE_FRAMEHDR) >> 8;
+    memcpy(traceBuffer + traceUsed, hdr, sizeof hdr);
+    traceUsed += frameUsed;
+    traceFrames++;
+
+    return true;
+}
+
+bool traceHit(unsigned int pc)
+{
+    bool resume = false;
+
+    if (!traceRunning)
+	return false;
+
+    traceBreakpoint *tb = findTraceBreakpoint(pc);
+    if (tb != NULL && !tb->gdbHolds)
+	resume = true;
+
+    for (int i = 0; i < numTracepoints && traceRunning; i++)
+    {
+	tracepoint *tp = &tracepoints[i];
+
+	if (!tp->enabled || tp->addr != pc)
+	    continue;
+
+	if (tp->cond != NULL)
+	{
+	    long long result;
+
+	    if (!axEvaluate(tp->cond, tp->condLength, result) || result == 0)
+		continue;
+	}
+
+	tp->hits++;
+	debugOut("tracepoint %u hit at 0x%x\n", tp->num, pc);
+	if (!collectFrame(tp))
+	    stopTracing(TRACE_FULL);
+	else if (tp->passCount != 0 && tp->hits >= tp->passCount)
+	    stopTracing(TRACE_PASSCOUNT, tp->num);
+    }
+
+    return resume;
+}
+
+/** Select trace frame 'n', return false if there is no such frame **/
+static bool selectFrame(int n)
+{
+    unsigned int offset = 0;
+
+    currentFrame = -1;
+    if (n < 0 || (unsigned int)n >= traceFrames)
+	return false;
+
+    for (int i = 0; i < n; i++)
+	offset += TRACE_FRAMEHDR + (traceBuffer[offset + 2] |
+				    (traceBuffer[offset + 3] << 8));
+    currentFrame = n;
+    currentFrameOffset = offset;
+
+    return true;
+}
+
+static unsigned int frameTracepoint(void)
+{
+    return traceBuffer[currentFrameOffset] |
+	(traceBuffer[currentFrameOffset + 1] << 8);
+}
+
+/** Return the address of the tracepoint that collected the selected
+    frame **/
+static unsigned long framePC(void)
+{
+    unsigned int num = frameTracepoint();
+
+    for (int i = 0; i < numTracepoints; i++)
+	if (tracepoints[i].num == num)
+	    return tracepoints[i].addr;
+    return 0;
+}
+
+/** Find the next block of type 'type' in the selected frame, starting
+    at 'pos' (0 for the first one).  Return a pointer to its contents,
+    and update 'pos', or return NULL. **/
+static uchar *frameBlock(char type, unsigned int &pos)
+{
+    uchar *frame = traceBuffer + currentFrameOffset + TRACE_FRAMEHDR;
+    unsigned int size = frame[-2] | (frame[-1] << 8);
+
+    while (pos < size)
+    {
+	uchar *block = frame + pos;
+	unsigned int blocksize;
+
+	if (block[0] == 'R')
+	    blocksize = 1 + REGFILE_SIZE;
+	else
+	    blocksize = 7 + (block[5] | (block[6] << 8));
+	pos += blocksize;
+
+	if (block[0] == type)
+	    return block + 1;
+    }
+
+    return NULL;
+}
+
+bool traceFrameSelected(void)
+{
+    return currentFrame >= 0;
+}
+
+bool traceFrameRegisters(uchar *regs)
+{
+    unsigned int pos = 0;
+    uchar *block = frameBlock('R', pos);
+
+    if (block != NULL)
+    {
+	memcpy(regs, block, REGFILE_SIZE);
+	return true;
+    }
+
+    unsigned long pc = framePC();
+    memset(regs, 0, REGFILE_SIZE);
+    regs[REGFILE_PC] = pc;
+    regs[REGFILE_PC + 1] = pc >> 8;
+    regs[REGFILE_PC + 2] = pc >> 16;
+    regs[REGFILE_PC + 3] = pc >> 24;
+
+    return false;
+}
+
+unsigned int traceFrameMemory(unsigned long addr, unsigned int length,
+			      uchar *buf)
+{
+    unsigned int done = 0;
+
+    // Assemble the longest run starting at 'addr' from all blocks.
+    while (done < length)
+    {
+	unsigned int pos = 0;
+	uchar *block;
+	bool found = false;
+
+	while ((block = frameBlock('M', pos)) != NULL)
+	{
+	    unsigned long start = block[0] | (block[1] << 8) |
+		(block[2] << 16) | ((unsigned long)block[3] << 24);
+	    unsigned int len = block[4] | (block[5] << 8);
+	    unsigned long want = addr + done;
+
+	    if (want >= start && want < start + len)
+	    {
+		unsigned int n = start + len - want;
+
+		if (n > length - done)
+		    n = length - done;
+		memcpy(buf + done, block + 6 + (want - start), n);
+		done += n;
+		found = true;
+		break;
+	    }
+	}
+	if (!found)
+	    break;
+    }
+
+    return done;
+}
+
+/** QTDP:n:addr:ena:step:pass[:Xlen,cond][-] and
+    QTDP:-n:addr:action[-] **/
+static bool defineTracepoint(char *ptr)
+{
+    bool isAction = *ptr == '-';
+
+    if (isAction)
+	ptr++;
+
+    unsigned int num = strtoul(ptr, &ptr, 16);
+    if (*ptr++ != ':')
+	return false;
+    unsigned long addr = strtoul(ptr, &ptr, 16);
+    if (*ptr++ != ':')
+	return false;
+
+    if (!isAction)
+    {
+	if (numTracepoints == MAX_TRACEPOINTS ||
+	    findTracepoint(num, addr) != NULL)
+	    return false;
+
+	tracepoint *tp = &tracepoints[numTracepoints];
+	memset(tp, 0, sizeof *tp);
+	tp->num = num;
+	tp->addr = addr;
+	tp->enabled = *ptr++ == 'E';
+	if (*ptr++ != ':')
+	    return false;
+	if (strtoul(ptr, &ptr, 16) != 0)
+	    statusOut("Tracepoint %u: while-stepping is not supported\n", num);
+	if (*ptr++ != ':')
+	    return false;
+	tp->passCount = strtoul(ptr, &ptr, 16);
+
+	while (*ptr == ':')
+	{
+	    ptr++;
+	    if (*ptr == 'X')
+	    {
+		ptr++;
+		tp->cond = parseBytecode(ptr, tp->condLength);
+		if (tp->cond == NULL)
+		    return false;
+	    }
+	    else
+	    {
+		// fast or static tracepoint
+		freeTracepoint(tp);
+		return false;
+	    }
+	}
+	numTracepoints++;
+	debugOut("tracepoint %u at 0x%lx\n", num, addr);
+	return true;
+    }
+
+    tracepoint *tp = findTracepoint(num, addr);
+    if (tp == NULL)
+	return false;
+
+    // while-stepping actions are not supported
+    if (*ptr == 'S')
+	return true;
+    if (tp->numActions == MAX_TRACE_ACTIONS)
+	return false;
+
+    traceAction *a = &tp->actions[tp->numActions];
+    memset(a, 0, sizeof *a);
+    a->type = *ptr++;
+    switch (a->type)
+    {
+    case 'R':
+	// the register mask is ignored, all registers are collected
+	break;
+
+    case 'M':
+	a->basereg = strtoul(ptr, &ptr, 16);
+	if (*ptr++ != ',')
+	    return false;
+	a->offset = strtoull(ptr, &ptr, 16);
+	if (*ptr++ != ',')
+	    return false;
+	a->length = strtoul(ptr, &ptr, 16);
+	break;
+
+    case 'X':
+	a->code = parseBytecode(ptr, a->length);
+	if (a->code == NULL)
+	    return false;
+	break;
+
+    default:
+	return false;
+    }
+    tp->numActions++;
+
+    return true;
+}
+
+/** QTFrame:n, QTFrame:pc:addr, QTFrame:tdp:n, QTFrame:range:lo:hi,
+    QTFrame:outside:lo:hi **/
+static void findFrame(char *ptr, char *reply)
+{
+    int start = currentFrame + 1;
+    bool found = false;
+
+    if (strncmp(ptr, "pc:", 3) == 0 || strncmp(ptr, "tdp:", 4) == 0 ||
+	strncmp(ptr, "range:", 6) == 0 || strncmp(ptr, "outside:", 8) == 0)
+    {
+	char type = *ptr;
+	unsigned long lo, hi;
+
+	ptr = strchr(ptr, ':') + 1;
+	lo = hi = strtoul(ptr, &ptr, 16);
+	if (*ptr == ':')
+	    hi = strtoul(ptr + 1, &ptr, 16);
+
+	for (int n = start; !found && selectFrame(n); n++)
+	{
+	    unsigned long pc = framePC();
+
+	    switch (type)
+	    {
+	    case 'p':
+		found = pc == lo;
+		break;
+	    case 't':
+		found = frameTracepoint() == lo;
+		break;
+	    case 'r':
+		found = pc >= lo && pc <= hi;
+		break;
+	    case 'o':
+		found = pc < lo || pc > hi;
+		break;
+	    }
+	}
+	if (!found)
+	    currentFrame = -1;
+    }
+    else
+	found = selectFrame((int)strtoul(ptr, NULL, 16));
+
+    if (found)
+	sprintf(reply, "F%xT%x", currentFrame, frameTracepoint());
+    else
+	strcpy(reply, "F-1");
+}
+
+static void traceStatus(char *reply)
+{
+    static const char *reasons[] = {
+	"tnotrun", "tstop", "tfull", "tpasscount"
+    };
+
+    if (traceRunning)
+	strcpy(reply, "T1");
+    else
+	sprintf(reply, "T0;%s:%x", reasons[stopReason], stopTracepoint);
+    sprintf(reply + strlen(reply),
+	    ";tframes:%x;tcreated:%x;tfree:%x;tsize:%x;circular:0;disconn:0",
+	    traceFrames, traceFrames, TRACE_BUFSIZE - traceUsed,
+	    TRACE_BUFSIZE);
+}
+
+bool traceShareBreakpoint(unsigned int addr, bool gdbHolds)
+{
+    traceBreakpoint *tb = findTraceBreakpoint(addr);
+
+    if (tb == NULL)
+	return false;
+
+    tb->gdbHolds = gdbHolds;
+    return true;
+}
+
+void traceRelease(void)
+{
+    // The ICE breakpoints are deleted wholesale by the caller
+    numTraceBreakpoints = 0;
+    stopTracing(TRACE_STOPPED);
+}
+
+bool traceCommand(char cmd, char *packet, char *reply)
+{
+    if (packet[0] != 'T')
+	return false;
+    packet++;
+
+    if (cmd == 'q')
+    {
+	if (strcmp(packet, "Status") == 0)
+	    traceStatus(reply);
+	else if (strncmp(packet, "P:", 2) == 0)
+	{
+	    // qTP:n:addr  tracepoint status
+	    char *ptr = packet + 2;
+	    unsigned int num = strtoul(ptr, &ptr, 16);
+	    unsigned long addr = *ptr == ':'? strtoul(ptr + 1, NULL, 16): 0;
+	    tracepoint *tp = findTracepoint(num, addr);
+
+	    if (tp == NULL)
+		strcpy(reply, "E01");
+	    else
+		sprintf(reply, "V%x:0", tp->hits);
+	}
+	else if (strcmp(packet, "fP") == 0 || strcmp(packet, "sP") == 0 ||
+		 strcmp(packet, "fV") == 0 || strcmp(packet, "sV") == 0)
+	    // nothing to upload
+	    strcpy(reply, "l");
+	else
+	    return false;
+
+	return true;
+    }
+
+    if (strcmp(packet, "init") == 0)
+    {
+	stopTracing(TRACE_STOPPED);
+	for (int i = 0; i < numTracepoints; i++)
+	    freeTracepoint(&tracepoints[i]);
+	numTracepoints = 0;
+	traceUsed = traceFrames = 0;
+	currentFrame = -1;
+	stopReason = TRACE_NOTRUN;
+	strcpy(reply, "OK");
+    }
+    else if (strncmp(packet, "DP:", 3) == 0)
+	strcpy(reply, defineTracepoint(packet + 3)? "OK": "E01");
+    else if (strncmp(packet, "Start", 5) == 0)
+	strcpy(reply, startTracing()? "OK": "E01");
+    else if (strcmp(packet, "Stop") == 0)
+    {
+	stopTracing(TRACE_STOPPED);
+	strcpy(reply, "OK");
+    }
+    else if (strncmp(packet, "Frame:", 6) == 0)
+	findFrame(packet + 6, reply);
+    else if (strncmp(packet, "Enable:", 7) == 0 ||
+	     strncmp(packet, "Disable:", 8) == 0)
+    {
+	char *ptr = strchr(packet, ':') + 1;
+	unsigned int num = strtoul(ptr, &ptr, 16);
+	unsigned long addr = *ptr == ':'? strtoul(ptr + 1, NULL, 16): 0;
+	tracepoint *tp = findTracepoint(num, addr);
+
+	if (tp == NULL || !enableTracepoint(tp, packet[0] == 'E'))
+	    strcpy(reply, "E01");
+	else
+	    strcpy(reply, "OK");
+    }
+    else if (strncmp(packet, "DPsrc:", 6) == 0 ||
+	     strncmp(packet, "DV:", 3) == 0 ||
+	     strncmp(packet, "ro", 2) == 0 ||
+	     strncmp(packet, "Buffer:", 7) == 0 ||
+	     strncmp(packet, "Notes:", 6) == 0 ||
+	     strncmp(packet, "Disconnected:", 13) == 0)
+	// accepted, but of no concern to us
+	strcpy(reply, "OK");
+    else
+	return false;
+
+    return true;
+}
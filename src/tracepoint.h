@@ -0,0 +1,65 @@
+/*
+ *	avarice - The "avarice" program.
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License Version 2
+ *      as published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ * This file declares the tracepoint engine behind gdb's "trace",
+ * "tstart" and "tfind" commands.
+ *
+ * $Id$
+ */
+
+#ifndef INCLUDE_TRACEPOINT_H
+#define INCLUDE_TRACEPOINT_H
+
+/** Handle the tracepoint packets of the remote protocol (qT..., QT...).
+    'cmd' is 'q' or 'Q', 'packet' the rest of the packet.  The reply is
+    stored in 'reply'.  Return false if this is not a tracepoint packet.
+**/
+bool traceCommand(char cmd, char *packet, char *reply);
+
+/** The target stopped at a code breakpoint at 'pc'.  If tracing is
+    running and there is a tracepoint at 'pc', collect a trace frame.
+    Return true if the breakpoint only exists for tracing, i.e. the
+    target should be resumed.
+**/
+bool traceHit(unsigned int pc);
+
+/** gdb sets ('gdbHolds') or deletes its code breakpoint at 'addr'.
+    Return true if tracing holds a breakpoint there, which is then
+    shared with gdb: the ICE breakpoint must be neither added again nor
+    deleted.
+**/
+bool traceShareBreakpoint(unsigned int addr, bool gdbHolds);
+
+/** gdb is gone, and all breakpoints are about to be deleted: stop
+    tracing. **/
+void traceRelease(void);
+
+/** True if gdb selected a trace frame (tfind) **/
+bool traceFrameSelected(void);
+
+/** Copy the registers of the selected trace frame into 'regs' (layout
+    see REGFILE_*).  Return false if the frame has no registers; only
+    the PC is filled in then.
+**/
+bool traceFrameRegisters(unsigned char *regs);
+
+/** Copy collected data memory of the selected trace frame at 'addr'
+    into 'buf'.  Return the number of bytes available, up to 'length'.
+**/
+unsigned int traceFrameMemory(unsigned long addr, unsigned int length,
+			      unsigned char *buf);
+
+#endif /* INCLUDE_TRACEPOINT_H */